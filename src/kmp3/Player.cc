@@ -129,7 +129,7 @@ Player::subStringSearch(Arena* pArena, Span<const wchar_t> spBuff)
 }
 
 long
-Player::nextSelectionI(long selI)
+Player::peekNextSelectionI(long selI)
 {
     const long currI = findSongI(selI);
     long nextI = currI + 1;
@@ -142,20 +142,45 @@ Player::nextSelectionI(long selI)
     }
     else if (nextI >= m_vSongIdxs.size())
     {
-        if (m_eRepeatMethod == PLAYER_REPEAT_METHOD::PLAYLIST)
-        {
-            nextI = 0;
-        }
-        else
-        {
-            app::g_vol_bRunning = false;
-            return m_vSongIdxs[currI];
-        }
+        if (m_eRepeatMethod == PLAYER_REPEAT_METHOD::PLAYLIST) nextI = 0;
+        else return NPOS;
     }
 
     return m_vSongIdxs[nextI];
 }
 
+long
+Player::nextSelectionI(long selI)
+{
+    const long nextI = peekNextSelectionI(selI);
+
+    if (nextI == NPOS)
+    {
+        app::g_vol_bRunning = false;
+        return m_vSongIdxs[findSongI(selI)];
+    }
+
+    return nextI;
+}
+
+void
+Player::preloadNext()
+{
+    /* NOTE: findSongI() resets the filtered list if the selected song is not in it, don't do that from here. */
+    if (m_bQuitOnSongEnd || m_vSongs.empty() ||
+        utils::searchI(m_vSearchIdxs, [&](u16 e) { return e == m_selectedI; }) == NPOS
+    )
+    {
+        m_svNextSong = {};
+        app::mixer().queueNext({});
+        return;
+    }
+
+    const long nextI = peekNextSelectionI(m_selectedI);
+    m_svNextSong = nextI != NPOS ? m_vSongs[nextI] : StringView{};
+    app::mixer().queueNext(m_svNextSong);
+}
+
 void
 Player::updateInfo() noexcept
 {
@@ -202,6 +227,7 @@ Player::selectFinal(long selI)
     m_bSelectionChanged = true;
     m_selectedI = selI;
     updateInfo();
+    preloadNext();
 }
 
 void
@@ -227,6 +253,33 @@ void
 Player::nextSongIfPrevEnded()
 {
     bool bExpected = true;
+    if (app::mixer().m_atom_bNextStarted.compareExchange(
+            &bExpected, false,
+            atomic::ORDER::ACQUIRE, atomic::ORDER::RELAXED
+        )
+    )
+    {
+        /* Decoder thread is already playing it, just catch up. */
+        StringView svStarted {};
+        {
+            LockScope lockNext {&app::nextDecoder().m_mtx};
+            svStarted = app::mixer().m_svNextStartedPath;
+        }
+
+        const isize startedI = utils::searchI(m_vSongs, [&](const StringView sv)
+            { return sv.data() == svStarted.data(); }
+        );
+
+        if (startedI != NPOS)
+        {
+            m_selectedI = startedI;
+            updateInfo();
+            preloadNext();
+            mpris::metadataChanged();
+        }
+    }
+
+    bExpected = true;
     if (app::mixer().m_atom_bSongEnd.compareExchange(
             &bExpected, false,
             atomic::ORDER::RELAXED, atomic::ORDER::RELAXED
@@ -246,6 +299,7 @@ Player::cycleRepeatMethods(bool bForward)
     else rm = utils::cycleBackward(isize(m_eRepeatMethod), isize(PLAYER_REPEAT_METHOD::ESIZE));
 
     m_eRepeatMethod = PLAYER_REPEAT_METHOD(rm);
+    preloadNext();
 
     mpris::loopStatusChanged();
 
@@ -293,6 +347,7 @@ Player::copySearchToSongIdxs()
 {
     m_vSongIdxs.setSize(m_pAlloc, m_vSearchIdxs.size());
     utils::memCopy(m_vSongIdxs.data(), m_vSearchIdxs.data(), m_vSearchIdxs.size());
+    if (app::g_pMixer) preloadNext();
 }
 
 void
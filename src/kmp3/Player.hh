@@ -51,6 +51,7 @@ struct Player
     Vec<u16> m_vSearchIdxs {}; /* search index buffer */
     long m_focusedI {};
     long m_selectedI {};
+    StringView m_svNextSong {}; /* Last one given to queueNext(). */
     isize m_longestString {};
     PLAYER_REPEAT_METHOD m_eRepeatMethod {};
     Mutex m_mtxQ {};
@@ -93,6 +94,7 @@ struct Player
     void selectNext();
     void selectPrev();
     void copySearchToSongIdxs();
+    void preloadNext(); /* Let the mixer open the next song ahead of time. */
     void setImgSize(long height);
     void adjustImgWidth() noexcept;
     void destroy();
@@ -102,6 +104,7 @@ struct Player
     /* */
 
 protected:
+    long peekNextSelectionI(long selI); /* NPOS if playlist ends. */
     long nextSelectionI(long selI);
     void updateInfo() noexcept;
     void selectFinal(long selI);
@@ -39,6 +39,14 @@ Config g_config = defaults::CONFIG;
 Player* g_pPlayer {};
 audio::IMixer* g_pMixer {};
 platform::ffmpeg::Decoder g_decoder {};
+platform::ffmpeg::Decoder g_nextDecoder {};
+loudness::Scanner g_loudnessScanner {};
+platform::ffmpeg::SeekIndexer g_seekIndexer {};
+platform::ffmpeg::StreamInfoCache g_streamInfoCache {};
+#ifdef OPT_CHAFA
+platform::ffmpeg::CoverLoader g_coverLoader {};
+platform::chafa::ImageCache g_imageCache {};
+#endif
 
 IWindow*
 allocWindow(IAllocator* pAlloc)
@@ -98,4 +106,42 @@ allocMixer(IAllocator* pAlloc)
     return pMix;
 }
 
+StringView
+cacheDir()
+{
+    static char s_aPath[1024] {};
+    static const isize s_size = [] {
+        const char* ntsXdg = ::getenv("XDG_CACHE_HOME");
+        const char* ntsHome = ::getenv("HOME");
+        isize n = 0;
+
+        if (ntsXdg && *ntsXdg)
+        {
+            n = print::toBuffer(s_aPath, sizeof(s_aPath) - 1, "{}/" PROJECT_NAME, ntsXdg);
+        }
+        else if (ntsHome && *ntsHome)
+        {
+            n = print::toBuffer(s_aPath, sizeof(s_aPath) - 1, "{}/.cache", ntsHome);
+            s_aPath[n] = '\0';
+            mkdir(s_aPath, 0755);
+            n = print::toBuffer(s_aPath, sizeof(s_aPath) - 1, "{}/.cache/" PROJECT_NAME, ntsHome);
+        }
+        else
+        {
+            return isize(0);
+        }
+
+        s_aPath[n] = '\0';
+        if (mkdir(s_aPath, 0755) != 0 && errno != EEXIST)
+        {
+            LogWarn{"failed to create '{}': {}\n", s_aPath, strerror(errno)};
+            return isize(0);
+        }
+
+        return n;
+    }();
+
+    return {s_aPath, s_size};
+}
+
 } /* namespace app */
@@ -4,10 +4,15 @@
 #include "Player.hh"
 #include "audio.hh"
 #include "config.hh"
+#include "loudness.hh"
 
 #include "platform/ansi/Win.hh"
 #include "platform/ffmpeg/Decoder.hh"
 
+#ifdef OPT_CHAFA
+    #include "platform/chafa/ImageCache.hh"
+#endif
+
 namespace app
 {
 
@@ -47,14 +52,31 @@ extern Config g_config;
 extern Player* g_pPlayer;
 extern audio::IMixer* g_pMixer;
 extern platform::ffmpeg::Decoder g_decoder;
+extern platform::ffmpeg::Decoder g_nextDecoder; /* Preopened next song for gapless playback. */
+extern loudness::Scanner g_loudnessScanner;
+extern platform::ffmpeg::SeekIndexer g_seekIndexer;
+extern platform::ffmpeg::StreamInfoCache g_streamInfoCache;
+#ifdef OPT_CHAFA
+extern platform::ffmpeg::CoverLoader g_coverLoader;
+extern platform::chafa::ImageCache g_imageCache;
+#endif
 
 inline Player& player() { return *g_pPlayer; }
 inline audio::IMixer& mixer() { return *g_pMixer; }
 inline platform::ffmpeg::Decoder& decoder() { return g_decoder; }
+inline platform::ffmpeg::Decoder& nextDecoder() { return g_nextDecoder; }
 inline platform::ansi::Win& window() { return *g_pWin; }
+inline loudness::Scanner& loudnessScanner() { return g_loudnessScanner; }
+inline platform::ffmpeg::SeekIndexer& seekIndexer() { return g_seekIndexer; }
+inline platform::ffmpeg::StreamInfoCache& streamInfoCache() { return g_streamInfoCache; }
+#ifdef OPT_CHAFA
+inline platform::ffmpeg::CoverLoader& coverLoader() { return g_coverLoader; }
+inline platform::chafa::ImageCache& imageCache() { return g_imageCache; }
+#endif
 
 IWindow* allocWindow(IAllocator* pArena);
 audio::IMixer* allocMixer(IAllocator* pAlloc);
+StringView cacheDir(); /* $XDG_CACHE_HOME/kmp3 or ~/.cache/kmp3, created on the first call, empty if neither works. */
 
 inline void quit() { g_vol_bRunning = false; }
 inline void focusNext() { player().focusNext(); }
@@ -73,7 +95,9 @@ inline void volumeUp(const long step) { g_pMixer->volumeUp(step); }
 inline void changeSampleRateDown(u64 ms, bool bSave) { g_pMixer->changeSampleRateDown(ms, bSave); }
 inline void changeSampleRateUp(u64 ms, bool bSave) { g_pMixer->changeSampleRateUp(ms, bSave); }
 inline void restoreSampleRate() { g_pMixer->restoreSampleRate(); }
+inline void togglePreservePitch() { g_pMixer->togglePreservePitch(); }
 inline void seekOff(f64 ms) { g_pMixer->seekOff(ms); }
+inline void markAbLoop() { g_pMixer->markAbLoop(); }
 inline PLAYER_REPEAT_METHOD cycleRepeatMethods(bool bForward) { player().m_bQuitOnSongEnd = false; return player().cycleRepeatMethods(bForward); }
 inline void selectPrev() { player().selectPrev(); }
 inline void selectNext() { player().selectNext(); }
@@ -83,7 +107,7 @@ inline void subStringSearch() { g_pWin->subStringSearch(); }
 inline void increaseImageSize(long i) { player().setImgSize(player().m_imgHeight + i); }
 inline void restoreImageSize() { player().setImgSize(g_config.imageHeight); }
 inline void cleanRedraw() { window().m_bClear = true; player().m_bRedrawImage = true; }
-inline void quitOnSongEnd() { player().m_bQuitOnSongEnd = !player().m_bQuitOnSongEnd; }
+inline void quitOnSongEnd() { player().m_bQuitOnSongEnd = !player().m_bQuitOnSongEnd; player().preloadNext(); }
 
 inline void
 testMsg()
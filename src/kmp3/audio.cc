@@ -1,8 +1,11 @@
 #include "audio.hh"
 
 #include "app.hh"
+#include "dsp.hh"
 #include "platform/mpris/mpris.hh"
 
+#include <cmath>
+
 namespace audio
 {
 
@@ -11,7 +14,12 @@ f32 g_aDrainBuffer[DRAIN_BUFFER_SIZE] {};
 IMixer&
 IMixer::startDecoderThread()
 {
-    new (&m_ringBuff) RingBuffer {RING_BUFFER_SIZE};
+    const BufferProfile& profile = BUFFER_PROFILES[int(app::g_config.eBufferProfile)];
+    new (&m_ringBuff) RingBuffer {
+        isize(profile.targetMs * m_deviceSampleRate / 1000.0) * MAX_RING_CHANNELS +
+        dsp::Resampler::MAX_OUT_FRAMES * MAX_RING_CHANNELS
+    };
+    updateRingLayout();
     new (&m_ringBuff.m_thrd) Thread {
         [](void* p) {
             IMixer& self = *static_cast<IMixer*>(p);
@@ -38,27 +46,537 @@ IMixer::refillRingBufferLoop()
     {
         {
             LockScope lockRing {&m_ringBuff.m_mtx};
-            while (!m_ringBuff.m_bQuit && m_ringBuff.m_size >= RING_BUFFER_LOW_THRESHOLD)
+            while (!m_ringBuff.m_bQuit && m_ringBuff.size() >= m_ringBuff.lowWatermark())
                 m_ringBuff.m_cnd.wait(&m_ringBuff.m_mtx);
 
             if (m_ringBuff.m_bQuit) break;
         }
 
         fillRingBuffer();
+        if (m_atom_bNextPending.load(atomic::ORDER::ACQUIRE)) openNext();
     }
 
     return THREAD_STATUS{0};
 }
 
+void
+IMixer::openNext()
+{
+    LockScope lockNext {&app::nextDecoder().m_mtx};
+
+    /* Previous song is still fading out of nextDecoder(), keep it pending. */
+    if (m_crossfade.m_bActive) return;
+
+    if (!m_atom_bNextPending.load(atomic::ORDER::ACQUIRE)) return;
+    m_atom_bNextPending.store(false, atomic::ORDER::RELAXED);
+
+    m_bNextReady = app::nextDecoder().open(m_svNextPath) == audio::ERROR::OK_;
+    if (!m_bNextReady) app::nextDecoder().close();
+
+    LogDebug{"next: '{}', ready: {}\n", m_svNextPath, m_bNextReady};
+}
+
 bool
-IMixer::playFinal(StringView svPath)
+IMixer::takeNext(StringView svPath)
 {
-    LockScope lockDec {&app::decoder().m_mtx};
+    if (!m_bNextReady || m_svNextPath != svPath) return false;
 
     if (m_atom_bDecodes.load(atomic::ORDER::ACQUIRE)) app::decoder().close();
+    app::decoder().swap(&app::nextDecoder());
+
+    m_bNextReady = false;
+    m_svNextPath = {};
+
+    return true;
+}
+
+void
+IMixer::nextStarted(StringView svPath)
+{
+    app::decoder().setOutputPcmType(m_ePcmType);
+    setSongSampleRate(app::decoder().getSampleRate(), false);
+    updateNormalizeGain(svPath);
+    updateRewindCache();
+    m_abLoop.reset();
+
+    m_currentTimeStamp = m_currMs = 0;
+    m_nTotalSamples = app::decoder().getTotalSamplesCount();
+    m_svNextStartedPath = svPath;
+    m_atom_bNextStarted.store(true, atomic::ORDER::RELEASE);
+}
+
+bool
+IMixer::startCrossfade()
+{
+    auto& next = app::nextDecoder();
+
+    if (!m_bNextReady || m_nTotalSamples <= 0 || m_abLoop.isActive()) return false;
+    if (next.getSampleRate() != m_sampleRate || next.getChannelsCount() != m_nChannels) return false;
+    /* Mixing is f32 only, bit-perfect songs end and start on their own. */
+    if (m_ePcmType != PCM_TYPE::F32 || pcmTypeFor(&next) != PCM_TYPE::F32) return false;
+
+    const i64 nFadeSamples = i64(app::g_config.crossfadeMs) * m_sampleRate * m_nChannels / 1000;
+    const i64 nLeft = m_nTotalSamples - m_currentTimeStamp;
+    if (nLeft > nFadeSamples) return false;
+
+    /* No close(), the previous song keeps decoding from nextDecoder() until the fade is over. */
+    const StringView svNext = m_svNextPath;
+    app::decoder().swap(&next);
+    m_bNextReady = false;
+    m_svNextPath = {};
+
+    m_crossfade.m_bActive = true;
+    m_crossfade.m_pos = 0;
+    m_crossfade.m_len = utils::max(nLeft / m_nChannels, i64(1));
+
+    LogDebug{"crossfade: {} frames\n", m_crossfade.m_len};
+
+    nextStarted(svNext);
+    m_rewind.invalidate(); /* Crossfade reads the decoders directly. */
+    return true;
+}
+
+void
+IMixer::crossfade()
+{
+    Crossfade& cf = m_crossfade;
+    const isize nBlockFrames = stagingBlockSize() / m_nChannels;
+    const f64 step = (3.14159265358979323846 / 2.0) / f64(cf.m_len);
+    const f64 cosStep = std::cos(step);
+    const f64 sinStep = std::sin(step);
+
+    while (m_ringBuff.size() < m_ringBuff.m_highWatermark)
+    {
+        const isize nFrames = utils::min(nBlockFrames, isize(cf.m_len - cf.m_pos));
+        const isize n = nFrames * m_nChannels;
+
+        isize nOut = 0, nIn = 0;
+        (void)app::nextDecoder().readSamples({cf.m_aOut, n}, &nOut);
+        const audio::ERROR eIn = app::decoder().readSamples({cf.m_aIn, n}, &nIn);
+        utils::memSet(cf.m_aOut + nOut, 0, n - nOut);
+
+        /* Rotate the (cos, sin) pair per frame, exact at the start of each block so it doesn't drift. */
+        f64 c = std::cos(step * cf.m_pos);
+        f64 s = std::sin(step * cf.m_pos);
+        for (isize frameI = 0; frameI < nFrames; ++frameI)
+        {
+            for (isize chI = 0; chI < m_nChannels; ++chI)
+            {
+                cf.m_aOutGain[frameI*m_nChannels + chI] = c;
+                cf.m_aInGain[frameI*m_nChannels + chI] = s;
+            }
+
+            const f64 tmp = c*cosStep - s*sinStep;
+            s = s*cosStep + c*sinStep;
+            c = tmp;
+        }
+
+        dsp::mixWeighted(cf.m_aOut, cf.m_aOutGain, cf.m_aIn, cf.m_aInGain, nIn);
+        pushToRing({cf.m_aOut, nIn});
+        cf.m_pos += nFrames;
+
+        m_currentTimeStamp = app::decoder().getCurrentSamplePos();
+        m_currMs = app::decoder().getCurrentMS();
+
+        if (eIn != audio::ERROR::OK_ || cf.m_pos >= cf.m_len)
+        {
+            stopCrossfade();
+            break;
+        }
+    }
+}
+
+void
+IMixer::setSongSampleRate(u32 sampleRate, bool bResetResampler)
+{
+    /* Keep the speed across songs, bit-perfect ones always play at 1.0. */
+    const f64 speed = m_ePcmType == PCM_TYPE::F32 ? f64(m_changedSampleRate) / f64(m_sampleRate) : 1.0;
+
+    m_sampleRate = sampleRate;
+    m_changedSampleRate = utils::clamp(
+        u64(std::round(f64(sampleRate) * speed)), app::g_config.minSampleRate, app::g_config.maxSampleRate
+    );
+
+    updateResampler(bResetResampler);
+}
+
+void
+IMixer::updateResampler(bool bReset)
+{
+    /* With m_bPreservePitch the time-stretch takes the speed change, whatever is out of its range goes to the resampler. */
+    const f64 speed = f64(m_changedSampleRate) / f64(m_sampleRate);
+    const f64 tempo = m_bPreservePitch ? utils::clamp(speed, dsp::TimeStretch::MIN_TEMPO, dsp::TimeStretch::MAX_TEMPO) : 1.0;
+    const f64 step = (f64(m_changedSampleRate) / tempo) / f64(m_deviceSampleRate);
+
+    if (bReset) m_bResample = m_bStretch = false;
+
+    /* Once enabled, stages stay on until the next reset, switching back to passthrough mid song would cut the history. */
+    if (!m_bStretch && !utils::floatEq(tempo, 1.0))
+    {
+        if (m_stretch.m_nChannels != m_nChannels || m_stretch.m_sampleRate != m_sampleRate)
+        {
+            m_stretch.destroy();
+            new(&m_stretch) dsp::TimeStretch {m_nChannels, m_sampleRate};
+        }
+
+        m_stretch.reset();
+        m_bStretch = true;
+    }
+
+    if (!m_bResample && !utils::floatEq(step, 1.0))
+    {
+        if (m_resampler.m_nChannels != m_nChannels)
+        {
+            m_resampler.destroy();
+            new(&m_resampler) dsp::Resampler {m_nChannels};
+        }
+
+        m_resampler.reset();
+        m_bResample = true;
+    }
+
+    if (m_bStretch) m_stretch.setTempo(tempo);
+    if (m_bResample) m_resampler.setStep(step);
+
+    LogDebug{"tempo: {}, resampler: {} -> {} (step: {})\n", tempo, f64(m_changedSampleRate) / tempo, m_deviceSampleRate, step};
+}
+
+void
+IMixer::updateRingLayout()
+{
+    const BufferProfile& profile = BUFFER_PROFILES[int(app::g_config.eBufferProfile)];
+
+    /* One staging block expands to at most MAX_OUT_FRAMES, the ring keeps room for it above the high watermark. */
+    const isize headroom = dsp::Resampler::MAX_OUT_FRAMES * m_nChannels;
+    isize high = isize(profile.targetMs * m_deviceSampleRate / 1000.0) * m_nChannels;
+    const isize cap = utils::min(isize(nextPowerOf2(high + headroom)), m_ringBuff.m_maxCap);
+    high = utils::min(high, cap - headroom);
+    const isize low = isize(f64(high) * profile.refillBelow);
+
+    m_ringBuff.setLayout(cap, low, high, pcmTypeSize(m_ePcmType));
+
+    LogDebug{"ring: cap: {}, low: {} ({} ms), high: {} ({} ms)\n",
+        cap, low, low * 1000 / (m_nChannels * m_deviceSampleRate), high, high * 1000 / (m_nChannels * m_deviceSampleRate)
+    };
+}
+
+PCM_TYPE
+IMixer::pcmTypeFor(IDecoder* pDecoder) const
+{
+    if (!app::g_config.bBitPerfect) return PCM_TYPE::F32;
+
+    const PCM_TYPE e = pDecoder->getNativePcmType();
+    return supportsPcmType(e) ? e : PCM_TYPE::F32;
+}
+
+void
+IMixer::selectPcmType()
+{
+    m_ePcmType = pcmTypeFor(&app::decoder());
+    app::decoder().setOutputPcmType(m_ePcmType);
+
+    /* Integer songs have no resampler, device follows them. */
+    m_deviceSampleRate = m_ePcmType == PCM_TYPE::F32 ? app::g_config.outputSampleRate : app::decoder().getSampleRate();
+
+    LogDebug{"pcm type: {}, device rate: {}\n", int(m_ePcmType), m_deviceSampleRate};
+}
+
+bool
+IMixer::needsDeviceConfig() const
+{
+    return m_nChannels != m_nDeviceChannels ||
+        m_deviceSampleRate != m_deviceConfiguredRate ||
+        m_ePcmType != m_eDevicePcmType;
+}
+
+void
+IMixer::updateRewindCache()
+{
+    m_rewind.setLayout(isize(app::g_config.rewindCacheSec) * m_sampleRate * m_nChannels, pcmTypeSize(m_ePcmType));
+    m_rewind.restart(0);
+}
+
+isize
+IMixer::stagingBlockSize() const
+{
+    f64 expansion = 1.0;
+    if (m_bResample) expansion /= m_resampler.m_step;
+    if (m_bStretch) expansion /= m_stretch.m_tempo;
+
+    /* Don't let one block expand into more than a stage outputs at once, ring has HIGH_THRESHOLD headroom for it. */
+    const isize nFrames = utils::clamp(
+        isize(f64(dsp::Resampler::MAX_OUT_FRAMES) / expansion),
+        isize(1), STAGING_BLOCK_SIZE / m_nChannels
+    );
+    return nFrames * m_nChannels;
+}
+
+void
+IMixer::pushToRing(Span<f32> sp)
+{
+    if (!m_bStretch)
+    {
+        resampleToRing(sp);
+        return;
+    }
+
+    while (sp.size() > 0)
+    {
+        isize nConsumed = 0;
+        const Span<f32> spOut = m_stretch.process(sp, &nConsumed);
+        if (spOut.size() > 0) resampleToRing(spOut);
+
+        if (nConsumed == 0 && spOut.size() == 0) break;
+        sp = {sp.data() + nConsumed, sp.size() - nConsumed};
+    }
+}
+
+void
+IMixer::resampleToRing(Span<f32> sp)
+{
+    if (!m_bResample)
+    {
+        processToRing(sp);
+        return;
+    }
+
+    while (sp.size() > 0)
+    {
+        isize nConsumed = 0;
+        const Span<f32> spOut = m_resampler.process(sp, &nConsumed);
+        if (spOut.size() > 0) processToRing(spOut);
+
+        if (nConsumed == 0 && spOut.size() == 0) break;
+        sp = {sp.data() + nConsumed, sp.size() - nConsumed};
+    }
+}
+
+void
+IMixer::processToRing(Span<f32> sp)
+{
+    processInPlace(sp);
+    m_ringBuff.push(sp);
+}
+
+void
+IMixer::processInPlace(Span<f32> sp)
+{
+    const f32 gain = m_volumeGain;
+    m_gain.setTarget(gain);
+    m_softClip.m_bEnabled = gain > 1.0f || m_gain.m_gain > 1.0f;
+
+    m_chain.process(sp, m_nChannels);
+}
+
+void*
+IMixer::reserveRing(isize* pnSamples)
+{
+    const isize nWanted = utils::min(m_ringBuff.m_highWatermark - m_ringBuff.size(), DIRECT_BLOCK_SIZE);
+
+    isize n = 0;
+    void* p = m_ringBuff.reserve(nWanted, &n);
+    n -= n % m_nChannels;
+
+    *pnSamples = n;
+    return n > 0 ? p : nullptr;
+}
+
+void
+IMixer::nativeToRing(isize n)
+{
+    m_gain.setTarget(m_volumeGain);
+
+    /* Bit-perfect. */
+    if (m_gain.isUnity())
+    {
+        m_ringBuff.pushRaw(m_aNativeStaging, n);
+        return;
+    }
+
+    m_softClip.m_bEnabled = m_volumeGain > 1.0f || m_gain.m_gain > 1.0f;
+
+    if (m_ePcmType == PCM_TYPE::S16) dsp::fromS16(m_aStaging, reinterpret_cast<const i16*>(m_aNativeStaging), n);
+    else dsp::fromS32(m_aStaging, reinterpret_cast<const i32*>(m_aNativeStaging), n);
+
+    m_chain.process({m_aStaging, n}, m_nChannels);
+
+    if (m_ePcmType == PCM_TYPE::S16) m_dither.toS16(reinterpret_cast<i16*>(m_aNativeStaging), m_aStaging, n);
+    else m_dither.toS32(reinterpret_cast<i32*>(m_aNativeStaging), m_aStaging, n);
+
+    m_ringBuff.pushRaw(m_aNativeStaging, n);
+}
+
+audio::ERROR
+IMixer::readSource(void* p, isize nSamples, isize* pnRead)
+{
+    if (m_abLoop.isLooping())
+    {
+        *pnRead = m_abLoop.replay(p, nSamples);
+        return audio::ERROR::OK_;
+    }
+
+    i64 pos = sourcePos();
+    if (m_abLoop.isActive())
+    {
+        if (pos >= m_abLoop.m_b)
+        {
+            if (m_abLoop.isRecorded())
+            {
+                LogDebug{"ab loop: recorded {} samples\n", m_abLoop.m_vData.size() / m_abLoop.m_sampleSize};
+                m_abLoop.m_replayPos = m_abLoop.m_a;
+                *pnRead = m_abLoop.replay(p, nSamples);
+                return audio::ERROR::OK_;
+            }
+
+            seekSource(m_abLoop.m_a);
+            pos = m_abLoop.m_a;
+        }
+
+        nSamples = utils::min(nSamples, isize(m_abLoop.m_b - pos));
+    }
+
+    audio::ERROR err = audio::ERROR::OK_;
+    if (m_rewind.isReplaying())
+    {
+        *pnRead = m_rewind.replay(p, nSamples);
+    }
+    else
+    {
+        err = app::decoder().readRaw(p, nSamples, pnRead);
+        m_rewind.append(p, *pnRead);
+    }
+
+    m_abLoop.record(pos, p, *pnRead);
+    return err;
+}
+
+i64
+IMixer::sourcePos() const
+{
+    if (m_abLoop.isLooping()) return m_abLoop.m_replayPos;
+    return m_rewind.m_end >= 0 ? m_rewind.pos() : app::decoder().getCurrentSamplePos();
+}
+
+void
+IMixer::seekSource(i64 pos)
+{
+    if (m_rewind.seek(pos))
+    {
+        LogDebug{"seek: {} from the rewind cache\n", pos};
+        return;
+    }
+
+    /* Middle of the frame, so the decoder's rounding lands on the same one. */
+    app::decoder().seekMS((f64(pos / m_nChannels) + 0.5) / f64(m_sampleRate) * 1000.0);
+    m_rewind.restart(pos);
+}
+
+audio::ERROR
+IMixer::writeNative()
+{
+    while (m_ringBuff.size() < m_ringBuff.m_highWatermark)
+    {
+        isize nRead = 0;
+        audio::ERROR err {};
+
+        /* Nothing to convert at unity gain, source goes straight into the ring. */
+        m_gain.setTarget(m_volumeGain);
+        isize nReserved = 0;
+        if (void* pDirect = m_gain.isUnity() ? reserveRing(&nReserved) : nullptr)
+        {
+            err = readSource(pDirect, nReserved, &nRead);
+            m_ringBuff.commit(nRead);
+        }
+        else
+        {
+            err = readSource(m_aNativeStaging, stagingBlockSize(), &nRead);
+            nativeToRing(nRead);
+        }
+
+        m_currentTimeStamp = sourcePos();
+
+        if (err != audio::ERROR::OK_) return err;
+    }
+
+    return audio::ERROR::OK_;
+}
+
+audio::ERROR
+IMixer::writeStaged()
+{
+    if (m_ePcmType != PCM_TYPE::F32) return writeNative();
+
+    while (m_ringBuff.size() < m_ringBuff.m_highWatermark)
+    {
+        isize nRead = 0;
+        audio::ERROR err {};
+
+        /* Resampler and time stretch change the size, the chain alone runs in place. */
+        isize nReserved = 0;
+        if (void* pDirect = !m_bResample && !m_bStretch ? reserveRing(&nReserved) : nullptr)
+        {
+            err = readSource(pDirect, nReserved, &nRead);
+            processInPlace({static_cast<f32*>(pDirect), nRead});
+            m_ringBuff.commit(nRead);
+        }
+        else
+        {
+            err = readSource(m_aStaging, stagingBlockSize(), &nRead);
+            pushToRing({m_aStaging, nRead});
+        }
+
+        m_currentTimeStamp = sourcePos();
+
+        if (err != audio::ERROR::OK_) return err;
+    }
+
+    return audio::ERROR::OK_;
+}
+
+void
+IMixer::stopCrossfade()
+{
+    if (!m_crossfade.m_bActive) return;
+
+    app::nextDecoder().close();
+    m_crossfade.m_bActive = false;
+}
+
+void
+IMixer::queueNext(StringView svPath)
+{
+    LockScope lockNext {&app::nextDecoder().m_mtx};
+
+    if (m_svNextPath == svPath) return;
+
+    if (m_bNextReady)
+    {
+        app::nextDecoder().close();
+        m_bNextReady = false;
+    }
+
+    m_svNextPath = svPath;
+    m_atom_bNextPending.store(bool(svPath), atomic::ORDER::RELEASE);
+    if (svPath) m_ringBuff.m_cnd.signal();
+}
+
+bool
+IMixer::playFinal(StringView svPath)
+{
+    LockScope lockDec {&app::decoder().m_mtx};
 
     m_ringBuff.clear();
+    m_abLoop.reset(); /* Marks belong to the previous song. */
     m_currentTimeStamp = m_nTotalSamples = m_currMs = 0;
+    m_atom_bNextStarted.store(false, atomic::ORDER::RELAXED); /* Explicit selection wins. */
+
+    {
+        LockScope lockNext {&app::nextDecoder().m_mtx};
+        stopCrossfade();
+        if (takeNext(svPath)) goto done;
+    }
+
+    if (m_atom_bDecodes.load(atomic::ORDER::ACQUIRE)) app::decoder().close();
 
     if (audio::ERROR err = app::decoder().open(svPath);
         err != audio::ERROR::OK_
@@ -67,6 +585,15 @@ IMixer::playFinal(StringView svPath)
         return false;
     }
 
+done:
+
+    m_nChannels = app::decoder().getChannelsCount();
+    selectPcmType();
+    updateRingLayout();
+    setSongSampleRate(app::decoder().getSampleRate(), true);
+    updateNormalizeGain(svPath);
+    updateRewindCache();
+
     m_nTotalSamples = app::decoder().getTotalSamplesCount();
     m_atom_bDecodes.store(true, atomic::ORDER::RELAXED);
     m_ringBuff.m_cnd.signal();
@@ -77,6 +604,17 @@ IMixer::playFinal(StringView svPath)
 IMixer&
 IMixer::start()
 {
+    m_deviceSampleRate = m_deviceConfiguredRate = m_sampleRate = m_changedSampleRate = app::g_config.outputSampleRate;
+    m_bPreservePitch = app::g_config.bPreservePitch;
+
+    new(&m_gain) dsp::Gain {m_deviceSampleRate, GAIN_RAMP_MS};
+    m_chain.clear();
+    m_chain.push(&m_gain);
+    if (app::g_config.maxVolume > 100) m_chain.push(&m_softClip);
+    updateVolumeGain();
+    m_gain.setTarget(m_volumeGain);
+    m_chain.reset();
+
     startDecoderThread().init();
     return *this;
 }
@@ -92,6 +630,10 @@ IMixer::destroy() noexcept
     }
     deinit();
     m_ringBuff.destroy();
+    m_rewind.destroy();
+    m_abLoop.destroy();
+    m_resampler.destroy();
+    m_stretch.destroy();
 }
 
 void
@@ -101,18 +643,39 @@ IMixer::fillRingBuffer()
 
     if (!m_atom_bDecodes.load(atomic::ORDER::ACQUIRE)) return;
 
-    long samplesWritten = 0;
-    audio::ERROR err = app::decoder().writeToRingBuffer(
-        &m_ringBuff,
-        m_nChannels,
-        m_ePcmType,
-        &samplesWritten,
-        &m_currentTimeStamp
-    );
-    m_currMs = app::decoder().getCurrentMS();
+    if (app::g_config.crossfadeMs > 0)
+    {
+        LockScope lockNext {&app::nextDecoder().m_mtx};
+        if (m_crossfade.m_bActive || startCrossfade())
+        {
+            crossfade();
+            return;
+        }
+    }
+
+    const audio::ERROR err = writeStaged();
+    m_currMs = calcCurrentMS();
 
     if (err == audio::ERROR::END_OF_FILE)
     {
+        {
+            /* Gapless: keep the stream running if the next song has the same layout, rate goes through the resampler.
+             * Bit-perfect songs need the same format and rate too, the device can't change mid stream. */
+            LockScope lockNext {&app::nextDecoder().m_mtx};
+            const StringView svNext = m_svNextPath;
+
+            if (m_bNextReady &&
+                app::nextDecoder().getChannelsCount() == m_nChannels &&
+                pcmTypeFor(&app::nextDecoder()) == m_ePcmType &&
+                (m_ePcmType == PCM_TYPE::F32 || app::nextDecoder().getSampleRate() == m_sampleRate) &&
+                takeNext(svNext)
+            )
+            {
+                nextStarted(svNext);
+                return;
+            }
+        }
+
         pause(true);
         app::decoder().close();
         m_ringBuff.clear();
@@ -131,6 +694,7 @@ void
 IMixer::toggleMute()
 {
     m_bMuted = !m_bMuted;
+    updateVolumeGain();
 }
 
 void
@@ -197,12 +761,31 @@ void
 IMixer::setVolume(const int volume)
 {
     m_volume = utils::clamp(volume, 0, app::g_config.maxVolume);
+    updateVolumeGain();
     LogInfo{"volume: {}\n", m_volume};
 #ifdef OPT_MPRIS
     mpris::volumeChanged();
 #endif
 }
 
+void
+IMixer::updateVolumeGain()
+{
+    m_volumeGain = m_bMuted ? 0.0f : std::pow(f32(m_volume) * (1.0f/100.0f), 3.0f) * m_normalizeGain;
+}
+
+void
+IMixer::updateNormalizeGain(StringView svPath)
+{
+    loudness::Result res {};
+    if (app::g_config.bNormalizeLoudness && app::loudnessScanner().find(svPath, &res))
+        m_normalizeGain = res.gain(app::g_config.loudnessTarget);
+    else m_normalizeGain = 1.0f;
+
+    updateVolumeGain();
+    LogDebug{"normalize gain: {}\n", m_normalizeGain};
+}
+
 f64
 IMixer::calcCurrentMS()
 {
@@ -215,6 +798,36 @@ IMixer::calcTotalMS()
     return (f64(m_nTotalSamples) / f64(m_sampleRate) / f64(m_nChannels)) * 1000.0;
 }
 
+void
+IMixer::changeSampleRate(u64 sampleRate, bool bSave)
+{
+    sampleRate = utils::clamp(sampleRate, app::g_config.minSampleRate, app::g_config.maxSampleRate);
+
+    LockScope lockDec {&app::decoder().m_mtx};
+
+    if (m_ePcmType != PCM_TYPE::F32)
+    {
+        LogInfo{"bit-perfect song, speed stays at 1.0\n"};
+        return;
+    }
+
+    if (bSave) m_sampleRate = sampleRate;
+    m_changedSampleRate = sampleRate;
+
+    updateResampler(false);
+}
+
+void
+IMixer::togglePreservePitch()
+{
+    LockScope lockDec {&app::decoder().m_mtx};
+
+    m_bPreservePitch = !m_bPreservePitch;
+    updateResampler(false);
+
+    LogInfo{"preserve pitch: {}\n", m_bPreservePitch};
+}
+
 void
 IMixer::changeSampleRateDown(int ms, bool bSave)
 {
@@ -241,24 +854,94 @@ IMixer::seekMS(f64 ms)
 
         if (!m_atom_bDecodes.load(atomic::ORDER::ACQUIRE)) return;
 
+        {
+            LockScope lockNext {&app::nextDecoder().m_mtx};
+            stopCrossfade();
+        }
+
         ms = utils::clamp(ms, 0.0, f64(app::decoder().getTotalMS()));
         m_ringBuff.clear();
         m_ringBuff.m_cnd.signal();
-        app::decoder().seekMS(ms);
+        if (m_bResample) m_resampler.reset();
+        if (m_bStretch) m_stretch.reset();
+
+        /* Same rounding as the decoder's seek target. */
+        const i64 target = i64(ms / 1000.0 * m_sampleRate) * m_nChannels;
+        if (m_abLoop.isActive() && (target < m_abLoop.m_a || target >= m_abLoop.m_b))
+        {
+            LogDebug{"ab loop: seek outside, stopped\n"};
+            m_abLoop.reset();
+        }
+
+        if (m_abLoop.isRecorded())
+        {
+            m_abLoop.m_replayPos = target;
+        }
+        else if (m_rewind.seek(target))
+        {
+            LogDebug{"seek: {} ms from the rewind cache\n", ms};
+        }
+        else
+        {
+            app::decoder().seekMS(ms);
+            m_rewind.restart(target);
+        }
 
         m_currMs = ms;
-        m_currentTimeStamp = (ms * m_sampleRate * m_nChannels) / 1000.0;
+        m_currentTimeStamp = target;
         m_nTotalSamples = app::decoder().getTotalSamplesCount();
     }
 
     mpris::seeked();
 }
 
+void
+IMixer::markAbLoop()
+{
+    f64 aMs {};
+    {
+        LockScope lock {&app::decoder().m_mtx};
+
+        if (m_crossfade.m_bActive) return;
+
+        if (m_abLoop.isActive())
+        {
+            /* Continue from where the loop is, the decoder is at B. */
+            const i64 pos = m_abLoop.isLooping() ? m_abLoop.m_replayPos : -1;
+            m_abLoop.reset();
+            if (pos >= 0) seekSource(pos);
+
+            LogInfo{"ab loop: off\n"};
+            return;
+        }
+
+        const i64 pos = m_currentTimeStamp - m_currentTimeStamp % m_nChannels;
+
+        if (m_abLoop.m_a < 0)
+        {
+            m_abLoop.m_a = pos;
+            LogInfo{"ab loop: A at {} ms\n", calcCurrentMS()};
+            return;
+        }
+
+        if (pos == m_abLoop.m_a) return;
+
+        m_abLoop.set(
+            utils::min(m_abLoop.m_a, pos), utils::max(m_abLoop.m_a, pos),
+            pcmTypeSize(m_ePcmType), AbLoop::MAX_SEC * m_sampleRate * m_nChannels
+        );
+        aMs = (f64(m_abLoop.m_a / m_nChannels) + 0.5) / f64(m_sampleRate) * 1000.0;
+        LogInfo{"ab loop: {} - {} ms\n", aMs, calcCurrentMS()};
+    }
+
+    seekMS(aMs);
+}
+
 void
 IMixer::seekOff(f64 offset)
 {
-    f64 time = app::decoder().getCurrentMS() + offset;
-    seekMS(time);
+    /* Not the decoder's position, it's ahead while replaying the rewind cache. */
+    seekMS(m_currMs + offset);
 }
 
 i64
@@ -274,13 +957,28 @@ IMixer::getTotalMS()
     return app::decoder().getTotalMS();
 }
 
-RingBuffer::RingBuffer(isize capacityPowOf2)
-    : m_cap{nextPowerOf2(capacityPowOf2)},
-      m_pData{Gpa::inst()->zallocV<f32>(m_cap)},
+RingBuffer::RingBuffer(isize maxCapacity)
+    : m_maxCap{nextPowerOf2(maxCapacity)},
+      m_pData{Gpa::inst()->zallocV<u8>(m_maxCap * sizeof(f32))},
       m_mtx{Mutex::TYPE::PLAIN},
       m_cnd{INIT}
 {
-    ADT_ASSERT(capacityPowOf2 > 0, "capacityPowOf2: {}", capacityPowOf2);
+    ADT_ASSERT(maxCapacity > 0, "maxCapacity: {}", maxCapacity);
+    setLayout(m_maxCap, m_maxCap / 4, m_maxCap / 4 * 3, sizeof(f32));
+}
+
+void
+RingBuffer::setLayout(isize capacity, isize lowWatermark, isize highWatermark, isize sampleSize) noexcept
+{
+    ADT_ASSERT(capacity <= m_maxCap && (capacity & (capacity - 1)) == 0, "capacity: {}, m_maxCap: {}", capacity, m_maxCap);
+    ADT_ASSERT(sampleSize > 0 && sampleSize <= isize(sizeof(f32)), "sampleSize: {}", sampleSize);
+
+    /* Empty ring, so a pop() racing with this has nothing to read with either capacity. */
+    clear();
+    m_atom_sampleSize.store(sampleSize, atomic::ORDER::RELEASE);
+    m_atom_cap.store(capacity, atomic::ORDER::RELEASE);
+    m_atom_lowWatermark.store(lowWatermark, atomic::ORDER::RELEASE);
+    m_highWatermark = highWatermark;
 }
 
 void
@@ -299,63 +997,255 @@ RingBuffer::destroy() noexcept
 }
 
 isize
-RingBuffer::push(const Span<const f32> sp) noexcept
+RingBuffer::pushRaw(const void* p, isize nSamples) noexcept
 {
-    LockScope lock {&m_mtx};
-
-    if (sp.size() + m_size > m_cap)
+    const u32 writeI = m_atom_writeI.load(atomic::ORDER::RELAXED);
+    const u32 readI = m_atom_readI.load(atomic::ORDER::ACQUIRE);
+    const isize size = u32(writeI - readI);
+    const isize cap = m_atom_cap.load(atomic::ORDER::RELAXED);
+    const isize sampleSize = m_atom_sampleSize.load(atomic::ORDER::RELAXED);
+    const u8* pSrc = static_cast<const u8*>(p);
+
+    if (nSamples + size > cap)
     {
-        LogWarn{"dropping out of range push (sp.size: {}, size, cap)\n", sp.size(), m_size, m_cap};
-        return sp.size();
+        LogWarn{"dropping out of range push (nSamples: {}, size: {}, cap: {})\n", nSamples, size, cap};
+        return size;
     }
 
-    const isize nextLastI = (m_lastI + sp.size()) & (m_cap - 1);
-
-    const isize nUntilEnd = utils::min(m_cap - m_lastI, sp.size());
-    utils::memCopy(m_pData + m_lastI, sp.data(), nUntilEnd);
-    utils::memCopy(m_pData, sp.data() + nUntilEnd, sp.size() - nUntilEnd);
+    const isize lastI = writeI & (cap - 1);
+    const isize nUntilEnd = utils::min(cap - lastI, nSamples);
+    utils::memCopy(m_pData + lastI*sampleSize, pSrc, nUntilEnd*sampleSize);
+    utils::memCopy(m_pData, pSrc + nUntilEnd*sampleSize, (nSamples - nUntilEnd)*sampleSize);
 
-    m_lastI = nextLastI;
-    m_size += sp.size();
-    m_cnd.signal();
-    return m_size;
+    m_atom_writeI.store(u32(writeI + nSamples), atomic::ORDER::RELEASE);
+    return size + nSamples;
 }
 
 isize
-RingBuffer::pop(Span<f32> sp) noexcept
+RingBuffer::popRaw(void* p, isize nSamples) noexcept
 {
-    LockScope lock {&m_mtx};
+    u32 readI = m_atom_readI.load(atomic::ORDER::RELAXED);
+    const u32 writeI = m_atom_writeI.load(atomic::ORDER::ACQUIRE);
+    const isize nAvail = u32(writeI - readI);
+    const isize cap = m_atom_cap.load(atomic::ORDER::ACQUIRE);
+    const isize sampleSize = m_atom_sampleSize.load(atomic::ORDER::ACQUIRE);
+    u8* pDst = static_cast<u8*>(p);
 
-    if (sp.size() > m_cap)
+    isize nPopped = utils::min(nAvail, nSamples);
+
+    const isize firstI = readI & (cap - 1);
+    const isize nUntilEnd = utils::min(cap - firstI, nPopped);
+    utils::memCopy(pDst, m_pData + firstI*sampleSize, nUntilEnd*sampleSize);
+    utils::memCopy(pDst + nUntilEnd*sampleSize, m_pData, (nPopped - nUntilEnd)*sampleSize);
+
+    if (!m_atom_readI.compareExchange(&readI, u32(readI + nPopped), atomic::ORDER::ACQ_REL, atomic::ORDER::RELAXED))
     {
-        LogWarn{"dropping some size: {} to {}\n", sp.size(), m_cap};
-        sp.m_size = m_cap;
+        /* clear() happened while copying, producer might have overwritten what we've read. */
+        nPopped = 0;
     }
-
-    while (!m_bQuit && sp.size() > m_size)
+    else if (nPopped < nSamples)
     {
-        LogWarn{"waiting for: {}, (m_size: {})\n", sp.size(), m_size};
-        m_cnd.wait(&m_mtx);
+        m_atom_nUnderruns.fetchAdd(1, atomic::ORDER::RELAXED);
     }
-    if (m_bQuit) return 0;
 
-    const isize nextFirstI = (m_firstI + sp.size()) & (m_cap - 1);
+    utils::memSet(pDst + nPopped*sampleSize, 0, (nSamples - nPopped)*sampleSize);
 
-    const isize nUntilEnd = utils::min(m_cap - m_firstI, sp.size());
-    utils::memCopy(sp.data(), m_pData + m_firstI, nUntilEnd);
-    utils::memCopy(sp.data() + nUntilEnd, m_pData, sp.size() - nUntilEnd);
+    if (nAvail - nPopped < lowWatermark()) m_cnd.signal();
+    return nPopped;
+}
 
-    m_firstI = nextFirstI;
-    m_size -= sp.size();
-    if (m_size < RING_BUFFER_LOW_THRESHOLD) m_cnd.signal();
-    return m_size;
+void*
+RingBuffer::reserve(isize nSamples, isize* pnReserved) noexcept
+{
+    const u32 writeI = m_atom_writeI.load(atomic::ORDER::RELAXED);
+    const u32 readI = m_atom_readI.load(atomic::ORDER::ACQUIRE);
+    const isize size = u32(writeI - readI);
+    const isize cap = m_atom_cap.load(atomic::ORDER::RELAXED);
+    const isize sampleSize = m_atom_sampleSize.load(atomic::ORDER::RELAXED);
+
+    const isize lastI = writeI & (cap - 1);
+    *pnReserved = utils::max(utils::min(nSamples, utils::min(cap - size, cap - lastI)), isize(0));
+    return m_pData + lastI*sampleSize;
+}
+
+isize
+RingBuffer::commit(isize nSamples) noexcept
+{
+    const u32 writeI = m_atom_writeI.load(atomic::ORDER::RELAXED);
+    const u32 readI = m_atom_readI.load(atomic::ORDER::ACQUIRE);
+
+    /* Consumer doesn't look past writeI, so the reserved part was never visible before this. */
+    m_atom_writeI.store(u32(writeI + nSamples), atomic::ORDER::RELEASE);
+    return isize(u32(writeI - readI)) + nSamples;
 }
 
 void
 RingBuffer::clear() noexcept
 {
-    LockScope lock {&m_mtx};
-    m_firstI = m_lastI = m_size = 0;
+    m_atom_readI.store(m_atom_writeI.load(atomic::ORDER::RELAXED), atomic::ORDER::RELEASE);
+}
+
+isize
+RingBuffer::size() const noexcept
+{
+    return u32(m_atom_writeI.load(atomic::ORDER::ACQUIRE) - m_atom_readI.load(atomic::ORDER::ACQUIRE));
+}
+
+isize
+RingBuffer::lowWatermark() const noexcept
+{
+    return m_atom_lowWatermark.load(atomic::ORDER::RELAXED);
+}
+
+int
+RingBuffer::nUnderruns() const noexcept
+{
+    return m_atom_nUnderruns.load(atomic::ORDER::RELAXED);
+}
+
+void
+RewindCache::destroy() noexcept
+{
+    Gpa::inst()->free(m_pData);
+    *this = {};
+}
+
+void
+RewindCache::setLayout(isize capacity, isize sampleSize)
+{
+    if (capacity * sampleSize > m_capBytes)
+    {
+        Gpa::inst()->free(m_pData);
+        m_capBytes = capacity * sampleSize;
+        m_pData = Gpa::inst()->zallocV<u8>(m_capBytes);
+    }
+
+    m_cap = capacity;
+    m_sampleSize = sampleSize;
+    invalidate();
+}
+
+void
+RewindCache::restart(i64 pos) noexcept
+{
+    m_size = 0;
+    m_end = pos;
+    m_replayPos = -1;
+}
+
+void
+RewindCache::invalidate() noexcept
+{
+    restart(-1);
+}
+
+bool
+RewindCache::seek(i64 pos) noexcept
+{
+    if (m_end < 0 || pos < m_end - m_size || pos > m_end) return false;
+
+    m_replayPos = pos < m_end ? pos : -1;
+    return true;
+}
+
+isize
+RewindCache::replay(void* p, isize nSamples) noexcept
+{
+    const isize n = utils::min(nSamples, isize(m_end - m_replayPos));
+    const isize firstI = m_replayPos % m_cap;
+    const isize nUntilEnd = utils::min(m_cap - firstI, n);
+    u8* pDst = static_cast<u8*>(p);
+
+    utils::memCopy(pDst, m_pData + firstI*m_sampleSize, nUntilEnd*m_sampleSize);
+    utils::memCopy(pDst + nUntilEnd*m_sampleSize, m_pData, (n - nUntilEnd)*m_sampleSize);
+
+    m_replayPos += n;
+    if (m_replayPos >= m_end) m_replayPos = -1;
+    return n;
+}
+
+void
+RewindCache::append(const void* p, isize nSamples) noexcept
+{
+    if (m_end < 0 || m_cap <= 0) return;
+
+    /* Only the last m_cap samples would survive anyway. */
+    const u8* pSrc = static_cast<const u8*>(p);
+    const isize nSkip = utils::max(nSamples - m_cap, isize(0));
+    const i64 start = m_end + nSkip;
+    const isize n = nSamples - nSkip;
+
+    const isize lastI = start % m_cap;
+    const isize nUntilEnd = utils::min(m_cap - lastI, n);
+    utils::memCopy(m_pData + lastI*m_sampleSize, pSrc + nSkip*m_sampleSize, nUntilEnd*m_sampleSize);
+    utils::memCopy(m_pData, pSrc + (nSkip + nUntilEnd)*m_sampleSize, (n - nUntilEnd)*m_sampleSize);
+
+    m_end += nSamples;
+    m_size = utils::min(m_size + nSamples, m_cap);
+}
+
+void
+AbLoop::destroy() noexcept
+{
+    m_vData.destroy();
+    *this = {};
+}
+
+void
+AbLoop::reset() noexcept
+{
+    m_vData.setSize(0);
+    m_a = m_b = m_fillPos = m_replayPos = -1;
+}
+
+void
+AbLoop::set(i64 a, i64 b, isize sampleSize, isize maxSamples)
+{
+    reset();
+    m_a = a;
+    m_b = b;
+    m_fillPos = a;
+    m_sampleSize = sampleSize;
+    m_maxSamples = maxSamples;
+}
+
+void
+AbLoop::record(i64 pos, const void* p, isize nSamples)
+{
+    /* Only what continues the recorded part, the rest gets another pass. */
+    if (m_fillPos < 0 || m_fillPos >= m_b || m_fillPos < pos || m_fillPos >= pos + nSamples) return;
+
+    const isize n = isize(utils::min(pos + nSamples, m_b) - m_fillPos);
+    if (m_fillPos - m_a + n > m_maxSamples)
+    {
+        LogDebug{"ab loop: segment is too long to keep, seeking every lap\n"};
+        m_vData.destroy();
+        m_fillPos = -1;
+        return;
+    }
+
+    const u8* pSrc = static_cast<const u8*>(p) + (m_fillPos - pos) * m_sampleSize;
+    m_vData.pushSpan({pSrc, n * m_sampleSize});
+    m_fillPos += n;
+}
+
+isize
+AbLoop::replay(void* p, isize nSamples) noexcept
+{
+    u8* pDst = static_cast<u8*>(p);
+    isize nDone = 0;
+
+    while (nDone < nSamples)
+    {
+        if (m_replayPos >= m_b) m_replayPos = m_a;
+
+        const isize n = utils::min(nSamples - nDone, isize(m_b - m_replayPos));
+        utils::memCopy(pDst + nDone*m_sampleSize, &m_vData[(m_replayPos - m_a) * m_sampleSize], n*m_sampleSize);
+        m_replayPos += n;
+        nDone += n;
+    }
+
+    return nDone;
 }
 
 } /* namespace audio */
@@ -1,27 +1,84 @@
 #pragma once
 
-#include "Image.hh"
+#include "dsp.hh"
 
 namespace audio
 {
 
-constexpr isize RING_BUFFER_SIZE = 1 << 16; /* Big enough. */
-constexpr isize RING_BUFFER_LOW_THRESHOLD = RING_BUFFER_SIZE * 0.25; /* Minimal size after which refillRingBufferLoop() kicks in. */
-constexpr isize RING_BUFFER_HIGH_THRESHOLD = RING_BUFFER_SIZE * 0.75; /* refillRingBufferLoop() will keep filling until this. */
-constexpr isize DRAIN_BUFFER_SIZE = 1 << 15; /* Usually its 1-2K frames*nChannels. */
+/* Staging for backends that can't pop straight into the device (sndio, alsa writei), in samples.
+ * Device periods aren't bounded by it: bit-perfect runs at the source rate (up to 192 kHz) and profiles ask for up to 250 ms,
+ * so callers pop at most this many samples at a time. */
+constexpr isize DRAIN_BUFFER_SIZE = 1 << 15;
 extern f32 g_aDrainBuffer[DRAIN_BUFFER_SIZE];
 
-enum class PCM_TYPE : u8 { S16, F32 };
+/* Format of the ring buffer and the device. S16/S32 only with Config::bBitPerfect, 24 bit sources come left aligned in S32. */
+enum class PCM_TYPE : u8 { S16, S32, F32 };
 
-/* NOTE: refillRingBufferLoop() thread will lock, push() and signal if pop() thread sits on the m_cnd (waiting for more data).
- * While pop() thread will signal if refillRingBufferLoop() thread is waiting on the same m_cnd. */
+[[nodiscard]] constexpr isize
+pcmTypeSize(PCM_TYPE e)
+{
+    return e == PCM_TYPE::S16 ? 2 : 4;
+}
+
+/* Ring buffer sizing for each BUFFER_PROFILE (config.hh).
+ * Watermarks are durations at the device rate, ring capacity follows from them and the channel count.
+ * Backends with their own buffer (alsa) take its size from here too, a device period must stay well below targetMs. */
+struct BufferProfile
+{
+    f64 targetMs {}; /* Refill stops here, also the latency of volume changes. */
+    f64 refillBelow {}; /* Fraction of targetMs that wakes the refill thread up. */
+    f64 devicePeriodMs {}; /* Popped from the ring at once. */
+    f64 deviceBufferMs {};
+};
+
+constexpr BufferProfile BUFFER_PROFILES[] {
+    {.targetMs = 500.0, .refillBelow = 0.33, .devicePeriodMs = 100.0, .deviceBufferMs = 500.0}, /* NORMAL */
+    {.targetMs = 80.0, .refillBelow = 0.5, .devicePeriodMs = 10.0, .deviceBufferMs = 40.0}, /* LOW_LATENCY: fast seeks and volume, more wake ups. */
+    {.targetMs = 4000.0, .refillBelow = 0.25, .devicePeriodMs = 250.0, .deviceBufferMs = 1000.0}, /* POWER_SAVE: ~3s decode bursts, idle in between. */
+};
+
+constexpr int MAX_RING_CHANNELS = 8; /* Ring is allocated for this many at the start, more get shorter buffering. */
+
+enum class ERROR : u8
+{
+    OK_ = 0,
+    END_OF_FILE,
+    DONE,
+    FAIL,
+};
+
+constexpr StringView mapERRORToString[] {
+    "OK_",
+    "EOF_OF_FILE",
+    "DONE",
+    "FAIL",
+};
+
+constexpr isize CACHE_LINE_SIZE = 64;
+
+/* Single producer / single consumer lock-free ring.
+ * Producer is the refillRingBufferLoop() thread (or anyone else holding decoder().m_mtx: seekMS(), playFinal()),
+ * consumer is the audio callback. Indices are free running, (writeI - readI) is the size even after they wrap.
+ * pop() never waits: missing samples are filled with silence and counted as an underrun.
+ * m_mtx/m_cnd are only used to put the refill thread to sleep, pop() signals without locking every time
+ * the size is below the low watermark, so a missed wake up costs one callback period at most.
+ * Storage is allocated once (m_maxCap f32 samples), setLayout() picks the used capacity, sample size and watermarks on an empty ring.
+ * Sizes and indices are in samples of the current sample size, push()/pop() are the f32 shortcuts.
+ * reserve()/commit() let the producer decode and process in place, without a staging copy. */
 struct RingBuffer
 {
-    isize m_firstI {};
-    isize m_lastI {};
-    isize m_size {};
-    isize m_cap {};
-    f32* m_pData {};
+    atomic::Num<u32> m_atom_writeI {}; /* Producer owned. */
+    u8 m_aPad0[CACHE_LINE_SIZE - sizeof(atomic::Num<u32>)] {};
+    atomic::Num<u32> m_atom_readI {}; /* Consumer owned, clear() resets it from the producer side. */
+    atomic::Int m_atom_nUnderruns {};
+    u8 m_aPad1[CACHE_LINE_SIZE - sizeof(atomic::Num<u32>) - sizeof(atomic::Int)] {};
+
+    atomic::Int m_atom_cap {}; /* Power of two <= m_maxCap. */
+    atomic::Int m_atom_sampleSize {}; /* Bytes. */
+    atomic::Int m_atom_lowWatermark {}; /* Size below which pop() wakes the refill thread. */
+    isize m_highWatermark {}; /* Producer only, refill keeps going until this. */
+    isize m_maxCap {};
+    u8* m_pData {};
 
     Mutex m_mtx {};
     CndVar m_cnd {};
@@ -32,43 +89,156 @@ struct RingBuffer
     /* */
 
     RingBuffer() = default;
-    RingBuffer(isize capacityPowOf2); /* capacityPowOf2 is rounded to next power of two */
+    RingBuffer(isize maxCapacity); /* Rounded to next power of two. */
+
+    /* */
+
+    void destroy() noexcept;
+    void setLayout(isize capacity, isize lowWatermark, isize highWatermark, isize sampleSize) noexcept; /* Producer side, clears the ring. */
+    isize pushRaw(const void* p, isize nSamples) noexcept; /* Returns size after push. */
+    isize popRaw(void* p, isize nSamples) noexcept; /* Returns number of samples taken from the ring, the rest of p is zeroed. */
+    [[nodiscard]] void* reserve(isize nSamples, isize* pnReserved) noexcept; /* Contiguous free space, less than nSamples at the end of the storage. */
+    isize commit(isize nSamples) noexcept; /* Publishes the first nSamples of the last reserve(), returns size after. */
+    isize push(const Span<const f32> sp) noexcept { return pushRaw(sp.data(), sp.size()); }
+    isize pop(Span<f32> sp) noexcept { return popRaw(sp.data(), sp.size()); }
+    void clear() noexcept; /* Producer side only. */
+    [[nodiscard]] isize size() const noexcept;
+    [[nodiscard]] isize lowWatermark() const noexcept;
+    [[nodiscard]] int nUnderruns() const noexcept;
+};
+
+constexpr f64 GAIN_RAMP_MS = 10.0; /* Volume changes are ramped over this long. */
+constexpr isize STAGING_BLOCK_SIZE = 1024; /* Samples read from the decoders at a time. */
+constexpr isize DIRECT_BLOCK_SIZE = STAGING_BLOCK_SIZE * 8; /* Same, straight into the ring, big enough for whole codec frames. */
+
+/* Equal-power crossfade state, after the swap app::nextDecoder() holds the tail of the previous song
+ * and app::decoder() the head of the new one. Guarded by both decoder mutexes. */
+struct Crossfade
+{
+    bool m_bActive {};
+    i64 m_pos {}; /* Frames. */
+    i64 m_len {}; /* Frames. */
+
+    alignas(CACHE_LINE_SIZE) f32 m_aOut[STAGING_BLOCK_SIZE] {}; /* Mixed in place. */
+    alignas(CACHE_LINE_SIZE) f32 m_aIn[STAGING_BLOCK_SIZE] {};
+    alignas(CACHE_LINE_SIZE) f32 m_aOutGain[STAGING_BLOCK_SIZE] {};
+    alignas(CACHE_LINE_SIZE) f32 m_aInGain[STAGING_BLOCK_SIZE] {};
+};
+
+/* Decoded audio of the current song (source rate, m_ePcmType) up to the decoder's position, Config::rewindCacheSec of it.
+ * Seeks inside replay it instead of seeking the demuxer, the decoder continues where the cache ends.
+ * Positions are absolute source samples (frames * channels), sample s is stored at s % m_cap.
+ * Guarded by app::decoder().m_mtx. */
+struct RewindCache
+{
+    u8* m_pData {};
+    isize m_capBytes {}; /* Allocated. */
+    isize m_cap {}; /* Samples for the current song. */
+    isize m_sampleSize = sizeof(f32);
+    isize m_size {}; /* Cached samples, they end at m_end. */
+    i64 m_end = -1; /* -1 while the position is unknown (crossfade), nothing gets cached then. */
+    i64 m_replayPos = -1; /* Next sample to replay, -1 while reading the decoder. */
 
     /* */
 
     void destroy() noexcept;
-    isize push(const Span<const f32> sp) noexcept; /* Returns size after push. */
-    isize pop(Span<f32> sp) noexcept;
-    void clear() noexcept;
+    void setLayout(isize capacity, isize sampleSize); /* Empty, unknown position. */
+    void restart(i64 pos) noexcept; /* Empty, decoder is at pos. */
+    void invalidate() noexcept;
+    [[nodiscard]] bool seek(i64 pos) noexcept; /* Replays from pos if it's cached. */
+    [[nodiscard]] isize replay(void* p, isize nSamples) noexcept; /* Stops at m_end. */
+    void append(const void* p, isize nSamples) noexcept;
+    [[nodiscard]] bool isReplaying() const noexcept { return m_replayPos >= 0; }
+    [[nodiscard]] i64 pos() const noexcept { return isReplaying() ? m_replayPos : m_end; }
 };
 
+/* A-B repeat of the current song. The segment is recorded from readSource() on its first pass (decoder or rewind cache),
+ * then it loops from memory and the decoder stays at B. Segments over MAX_SEC aren't kept, every lap seeks back to A.
+ * Positions are absolute source samples like in RewindCache. Guarded by app::decoder().m_mtx. */
+struct AbLoop
+{
+    static constexpr isize MAX_SEC = 600;
+
+    VecManaged<u8> m_vData {}; /* From m_a up to m_fillPos. */
+    isize m_sampleSize = sizeof(f32);
+    isize m_maxSamples {};
+    i64 m_a = -1;
+    i64 m_b = -1; /* -1 while only A is marked. */
+    i64 m_fillPos = -1; /* -1 if the segment is too long. */
+    i64 m_replayPos = -1; /* -1 until the first pass reaches B. */
+
+    /* */
+
+    void destroy() noexcept;
+    void reset() noexcept; /* Unmarks both, keeps the memory. */
+    void set(i64 a, i64 b, isize sampleSize, isize maxSamples);
+    void record(i64 pos, const void* p, isize nSamples);
+    [[nodiscard]] isize replay(void* p, isize nSamples) noexcept; /* Wraps around at m_b. */
+    [[nodiscard]] bool isActive() const noexcept { return m_b >= 0; }
+    [[nodiscard]] bool isRecorded() const noexcept { return isActive() && m_fillPos == m_b; }
+    [[nodiscard]] bool isLooping() const noexcept { return m_replayPos >= 0; }
+};
+
+struct IDecoder;
+
 /* Platrform abstracted audio interface */
 struct IMixer
 {
     atomic::Bool m_atom_bPaused {false};
     atomic::Bool m_atom_bSongEnd {false};
     atomic::Bool m_atom_bDecodes {false};
+    atomic::Bool m_atom_bNextPending {false}; /* queueNext() was called, refill thread should open it. */
+    atomic::Bool m_atom_bNextStarted {false}; /* Decoder thread switched to the next song without stopping. */
 
     bool m_bMuted = false;
     bool m_bRunning = true;
-    u32 m_sampleRate = 48000;
-    u32 m_changedSampleRate = 48000;
+    u32 m_sampleRate = 48000; /* Current song's rate. */
+    u32 m_changedSampleRate = 48000; /* m_sampleRate * speed. */
+    u32 m_deviceSampleRate = 48000; /* Output rate, Config::outputSampleRate or the song's own rate when bit-perfect. */
+    u32 m_deviceConfiguredRate = 48000; /* What the backend has the device opened with, */
     u8 m_nChannels = 2;
+    u8 m_nDeviceChannels = 2;
+    PCM_TYPE m_eDevicePcmType = PCM_TYPE::F32; /* play() reconfigures when any of these differ from the song. */
     int m_volume = 40;
-    PCM_TYPE m_ePcmType = PCM_TYPE::F32;
+    f32 m_volumeGain = 0.064f; /* Cubic curve of m_volume times m_normalizeGain (0 when muted), target of m_gain. */
+    f32 m_normalizeGain = 1.0f; /* Loudness normalization of the current song. */
+    atomic::Int m_atom_nXruns {}; /* Device side underruns and other recoveries, counted by backends that see them (alsa). */
+    PCM_TYPE m_ePcmType = PCM_TYPE::F32; /* Integer only for bit-perfect songs, they skip the resampler and the time-stretch. */
     i64 m_currentTimeStamp {};
     i64 m_nTotalSamples {};
     f64 m_currMs {};
 
     RingBuffer m_ringBuff {};
 
+    /* Guarded by app::nextDecoder().m_mtx. */
+    StringView m_svNextPath {};
+    StringView m_svNextStartedPath {}; /* What the m_atom_bNextStarted was set for. */
+    bool m_bNextReady = false;
+
+    Crossfade m_crossfade {};
+
+    /* Decoder thread side, guarded by app::decoder().m_mtx. */
+    dsp::TimeStretch m_stretch {};
+    dsp::Resampler m_resampler {};
+    bool m_bStretch = false; /* Only with m_bPreservePitch and speed != 1. */
+    bool m_bResample = false; /* Passthrough while m_changedSampleRate == m_deviceSampleRate. */
+    bool m_bPreservePitch = false; /* Speed keys change tempo through m_stretch instead of the pitch. */
+    dsp::Chain m_chain {}; /* Runs on every block right before the ring buffer, backends only copy. */
+    dsp::Gain m_gain {};
+    dsp::SoftClip m_softClip {}; /* In the chain only when maxVolume > 100. */
+    dsp::Dither m_dither {}; /* Integer songs away from unity gain. */
+    RewindCache m_rewind {};
+    AbLoop m_abLoop {};
+    alignas(CACHE_LINE_SIZE) f32 m_aStaging[STAGING_BLOCK_SIZE] {};
+    alignas(CACHE_LINE_SIZE) u8 m_aNativeStaging[STAGING_BLOCK_SIZE * sizeof(f32)] {}; /* Integer samples of m_ePcmType. */
+
     /* */
 
     virtual IMixer& init() = 0;
     virtual void deinit() = 0;
     virtual bool play(StringView svPath) = 0;
     virtual void pause(bool bPause) = 0;
-    virtual void changeSampleRate(u64 sampleRate, bool bSave) = 0;
+    [[nodiscard]] virtual bool supportsPcmType(PCM_TYPE e) const { return e == PCM_TYPE::F32; }
 
     /* */
 
@@ -90,18 +260,50 @@ struct IMixer
     void setVolume(const int volume);
     [[nodiscard]] f64 calcCurrentMS();
     [[nodiscard]] f64 calcTotalMS();
+    void changeSampleRate(u64 sampleRate, bool bSave); /* Only changes the resampler ratio, device stays as is. */
+    void togglePreservePitch();
     void changeSampleRateDown(int ms, bool bSave);
     void changeSampleRateUp(int ms, bool bSave);
     void restoreSampleRate();
     void seekMS(f64 ms);
     void seekOff(f64 offset);
+    void markAbLoop(); /* Marks A, then B and starts looping, third call stops. */
     [[nodiscard]] i64 getCurrentMS();
     [[nodiscard]] i64 getTotalMS();
+    void queueNext(StringView svPath); /* Song to continue with on END_OF_FILE, empty svPath to cancel. */
 
 protected:
     IMixer& startDecoderThread();
     THREAD_STATUS refillRingBufferLoop();
     bool playFinal(StringView svPath);
+    void openNext();
+    /* Both decoder mutexes must be locked. */
+    bool takeNext(StringView svPath);
+    void nextStarted(StringView svPath);
+    bool startCrossfade();
+    void crossfade();
+    void stopCrossfade();
+    void setSongSampleRate(u32 sampleRate, bool bResetResampler);
+    void updateResampler(bool bReset);
+    void updateRingLayout();
+    void updateRewindCache(); /* For the current song, position 0. */
+    [[nodiscard]] PCM_TYPE pcmTypeFor(IDecoder* pDecoder) const;
+    void selectPcmType(); /* Song's format and output rate, decoder must be open. */
+    [[nodiscard]] bool needsDeviceConfig() const;
+    [[nodiscard]] isize stagingBlockSize() const;
+    void updateVolumeGain();
+    void updateNormalizeGain(StringView svPath);
+    void pushToRing(Span<f32> sp);
+    void resampleToRing(Span<f32> sp);
+    void processToRing(Span<f32> sp);
+    void processInPlace(Span<f32> sp); /* Gain and the rest of the chain. */
+    void nativeToRing(isize n);
+    [[nodiscard]] void* reserveRing(isize* pnSamples); /* Whole frames of ring space for readSource(), nullptr if there isn't one. */
+    [[nodiscard]] ERROR readSource(void* p, isize nSamples, isize* pnRead); /* A-B loop, rewind cache replay, then the decoder. */
+    [[nodiscard]] i64 sourcePos() const; /* Read position of readSource(). */
+    void seekSource(i64 pos); /* Rewind cache or the decoder, ring is left as is. */
+    [[nodiscard]] ERROR writeStaged();
+    [[nodiscard]] ERROR writeNative();
 };
 
 struct DummyMixer : public IMixer
@@ -110,22 +312,6 @@ struct DummyMixer : public IMixer
     virtual void deinit() override final {}
     virtual bool play(StringView) override final { return true; }
     virtual void pause(bool) override final {}
-    virtual void changeSampleRate(u64, bool) override final {}
-};
-
-enum class ERROR : u8
-{
-    OK_ = 0,
-    END_OF_FILE,
-    DONE,
-    FAIL,
-};
-
-constexpr StringView mapERRORToString[] {
-    "OK_",
-    "EOF_OF_FILE",
-    "DONE",
-    "FAIL",
 };
 
 struct IDecoder
@@ -135,13 +321,14 @@ struct IDecoder
 
     /* */
 
-    [[nodiscard]] virtual ERROR writeToRingBuffer(
-        audio::RingBuffer* pRingBuff,
-        const int nChannels,
-        const PCM_TYPE ePcmType,
-        long* pSamplesWritten,
-        isize* pPcmPos
-    ) = 0;
+    /* Interleaved f32 in the mixer's layout, reads less than sp.size() only with END_OF_FILE. */
+    [[nodiscard]] virtual ERROR readSamples(Span<f32> sp, isize* pnRead) = 0;
+
+    /* Same in the output format, samples of pcmTypeSize(). */
+    [[nodiscard]] virtual ERROR readRaw(void* pDst, isize nSamples, isize* pnRead) = 0;
+
+    [[nodiscard]] virtual PCM_TYPE getNativePcmType() = 0; /* F32 unless the codec decodes to integers. */
+    virtual void setOutputPcmType(PCM_TYPE e) = 0; /* F32 after each open(). */
 
     virtual IDecoder& init() noexcept(false) = 0; /* RuntimeException */
     virtual void destroy() = 0;
@@ -153,7 +340,6 @@ struct IDecoder
     [[nodiscard]] virtual i64 getTotalSamplesCount() = 0;
     [[nodiscard]] virtual int getChannelsCount() = 0;
     [[nodiscard]] virtual StringView getMetadata(const StringView sKey) = 0;
-    [[nodiscard]] virtual Image getCoverImage() = 0;
     [[nodiscard]] virtual ERROR open(StringView sPath) = 0;
     virtual void close() = 0;
 };
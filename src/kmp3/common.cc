@@ -31,14 +31,34 @@ allocTimeString(IArena* pArena, int width)
     const u64 maxMin = totalT / 60;
     const u64 maxSec = totalT - (60 * maxMin);
 
-    const isize n = print::toBuffer(pBuff, width, "time: {}:{:2 > f0} / {}:{:2 > f0}", currMin, currSec, maxMin, maxSec);
-    if (mix.getSampleRate() != mix.getChangedSampleRate())
+    isize n = print::toBuffer(pBuff, width, "time: {}:{:2 > f0} / {}:{:2 > f0}", currMin, currSec, maxMin, maxSec);
+    if (mix.getSampleRate() != mix.getChangedSampleRate() && n < width)
     {
-        print::toBuffer(pBuff + n, width - n, " ({}% speed)",
-            int(std::round(f64(mix.getChangedSampleRate()) / f64(mix.getSampleRate()) * 100.0))
+        n += print::toBuffer(pBuff + n, width - n, " ({}% {})",
+            int(std::round(f64(mix.getChangedSampleRate()) / f64(mix.getSampleRate()) * 100.0)),
+            mix.m_bPreservePitch ? "tempo" : "speed"
         );
     }
 
+    if (const i64 a = mix.m_abLoop.m_a; a >= 0 && n < width)
+    {
+        /* Unlocked, a torn read only shows the wrong time for a frame. */
+        const auto toSec = [&](i64 pos) {
+            return u64(std::round(f64(pos) / f64(mix.getSampleRate()) / f64(mix.getNChannels()) * sampleRateRatio));
+        };
+
+        const u64 aT = toSec(a);
+        n += print::toBuffer(pBuff + n, width - n, " loop: {}:{:2 > f0}-", aT / 60, aT % 60);
+        if (const i64 b = mix.m_abLoop.m_b; b >= 0 && n < width)
+        {
+            const u64 bT = toSec(b);
+            n += print::toBuffer(pBuff + n, width - n, "{}:{:2 > f0}", bT / 60, bT % 60);
+        }
+    }
+
+    if (const int nXruns = mix.m_atom_nXruns.load(atomic::ORDER::RELAXED); nXruns > 0 && n < width)
+        n += print::toBuffer(pBuff + n, width - n, " xruns: {}", nXruns);
+
     return pBuff;
 }
 
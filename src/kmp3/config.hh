@@ -1,5 +1,7 @@
 #pragma once
 
+enum class BUFFER_PROFILE : u8 { NORMAL, LOW_LATENCY, POWER_SAVE }; /* audio::BUFFER_PROFILES */
+
 struct Config
 {
     int maxVolume {};
@@ -8,6 +10,8 @@ struct Config
     int imageUpdateRateLimit {};
     u64 minSampleRate {};
     u64 maxSampleRate {};
+    u32 outputSampleRate {};
+    bool bPreservePitch {};
     f64 fontAspectRatio {};
     int mouseScrollStep {};
     u8 imageHeight {};
@@ -18,4 +22,14 @@ struct Config
     int minWidth {};
     int minHeight {};
     isize frameArenaReserveVirtualSpace {};
+    int crossfadeMs {};
+    bool bNormalizeLoudness {};
+    f64 loudnessTarget {};
+    BUFFER_PROFILE eBufferProfile {};
+    bool bBitPerfect {};
+    bool bSeekIndex {};
+    bool bStreamInfoCache {};
+    int rewindCacheSec {};
+    isize imageCacheSize {};
+    bool bCoverCache {};
 };
@@ -6,12 +6,14 @@ namespace defaults
 {
 
 constexpr Config CONFIG {
-    .maxVolume = 150, /* (0, 100], > 100 might cause distortions. */
+    .maxVolume = 150, /* (0, 100], > 100 is soft clipped. */
     .volume = 40, /* Startup volume. */
     .updateRate = 500, /* Ui update rate (ms). */
     .imageUpdateRateLimit = 100, /* (ms). */
     .minSampleRate = 1000,
     .maxSampleRate = 9999999,
+    .outputSampleRate = 48000, /* Device rate, songs and speed changes are resampled to it. */
+    .bPreservePitch = false, /* Speed keys time-stretch instead of shifting pitch (toggle with 'P'). */
     .fontAspectRatio = 1.0 / 2.0, /* Typical monospaced font is 1/2 or 3/5 (width/height). */
     .mouseScrollStep = 4,
     .imageHeight = 11, /* Terminal rows height. */
@@ -22,6 +24,16 @@ constexpr Config CONFIG {
     .minWidth = 35,
     .minHeight = 17,
     .frameArenaReserveVirtualSpace = SIZE_1M * 64,
+    .crossfadeMs = 0, /* Equal-power overlap between consecutive songs (ms), 0 is plain gapless. */
+    .bNormalizeLoudness = false, /* Measure songs in the background (cached) and level them to loudnessTarget. */
+    .loudnessTarget = -18.0, /* LUFS, ReplayGain 2.0 reference level. */
+    .eBufferProfile = BUFFER_PROFILE::NORMAL, /* LOW_LATENCY (~80ms) or POWER_SAVE (~4s, decodes in bursts). */
+    .bBitPerfect = false, /* Integer sources go to alsa/pipewire untouched at 100% volume (no speed or crossfade for them). */
+    .bSeekIndex = true, /* Index files with estimated duration (VBR mp3 without a TOC, adts) in the background for exact seeks and length. */
+    .bStreamInfoCache = true, /* Remember probed stream parameters, known files open without avformat_find_stream_info(). */
+    .rewindCacheSec = 30, /* Decoded audio kept in memory, seeks inside it don't touch the file. 0 to disable. */
+    .imageCacheSize = SIZE_1M * 32, /* Rendered covers kept for songs and sizes shown before (bytes). */
+    .bCoverCache = true, /* Keep downscaled covers on disk, songs of one album share them. */
 };
 
 } /* namespace defaults */
@@ -0,0 +1,435 @@
+#include "dsp.hh"
+
+#include <cmath>
+#include <limits>
+
+namespace dsp
+{
+
+static f64
+besselI0(const f64 x)
+{
+    f64 sum = 1.0;
+    f64 term = 1.0;
+    const f64 xx = (x * x) / 4.0;
+
+    for (int k = 1; k < 64 && term > sum * 1e-12; ++k)
+    {
+        term *= xx / f64(k * k);
+        sum += term;
+    }
+
+    return sum;
+}
+
+void
+Chain::push(IProcessor* pProcessor) noexcept
+{
+    m_aProcessors.push(pProcessor);
+}
+
+void
+Chain::clear() noexcept
+{
+    m_aProcessors.setSize(0);
+}
+
+void
+Chain::reset() noexcept
+{
+    for (IProcessor* pProcessor : m_aProcessors) pProcessor->reset();
+}
+
+void
+Chain::process(Span<f32> sp, int nChannels) noexcept
+{
+    for (IProcessor* pProcessor : m_aProcessors) pProcessor->process(sp, nChannels);
+}
+
+Gain::Gain(u32 sampleRate, f64 rampMs)
+    : m_rampFrames {utils::max(isize(f64(sampleRate) * rampMs / 1000.0), isize(1))}
+{
+}
+
+void
+Gain::setTarget(f32 target) noexcept
+{
+    if (target == m_target) return;
+
+    m_target = target;
+    m_rampLeft = m_rampFrames;
+    m_step = (m_target - m_gain) / f32(m_rampFrames);
+}
+
+void
+Gain::process(Span<f32> sp, int nChannels) noexcept
+{
+    const isize nFrames = sp.size() / nChannels;
+    isize frameI = 0;
+
+    if (m_rampLeft > 0)
+    {
+        const isize nRamp = utils::min(nFrames, m_rampLeft);
+
+        switch (nChannels)
+        {
+            case 1: scaleRamp<1>(sp.data(), nRamp, 1, m_gain, m_step); break;
+            case 2: scaleRamp<2>(sp.data(), nRamp, 2, m_gain, m_step); break;
+            case 4: scaleRamp<4>(sp.data(), nRamp, 4, m_gain, m_step); break;
+            case 8: scaleRamp<8>(sp.data(), nRamp, 8, m_gain, m_step); break;
+            default: scaleRamp<0>(sp.data(), nRamp, nChannels, m_gain, m_step); break;
+        }
+
+        m_rampLeft -= nRamp;
+        m_gain = m_rampLeft > 0 ? m_gain + m_step*f32(nRamp) : m_target;
+        frameI = nRamp;
+    }
+
+    if (frameI >= nFrames || m_gain == 1.0f) return;
+
+    scale(sp.data() + frameI*nChannels, m_gain, (nFrames - frameI) * nChannels);
+}
+
+void
+Gain::reset() noexcept
+{
+    m_gain = m_target;
+    m_rampLeft = 0;
+}
+
+void
+SoftClip::process(Span<f32> sp, int) noexcept
+{
+    if (!m_bEnabled) return;
+
+    softClip(sp.data(), KNEE, sp.size());
+}
+
+f32
+Dither::tpdf() noexcept
+{
+    auto next = [&] {
+        m_state ^= m_state << 13;
+        m_state ^= m_state >> 17;
+        m_state ^= m_state << 5;
+        return f32(m_state >> 8) * (1.0f / f32(1 << 24)); /* [0, 1) */
+    };
+
+    const f32 a = next();
+    return a - next();
+}
+
+void
+Dither::toS16(i16* pDst, const f32* pSrc, isize n) noexcept
+{
+    for (isize i = 0; i < n; ++i)
+    {
+        const f32 x = std::floor(pSrc[i]*32768.0f + tpdf() + 0.5f);
+        pDst[i] = i16(utils::clamp(x, -32768.0f, 32767.0f));
+    }
+}
+
+void
+Dither::toS32(i32* pDst, const f32* pSrc, isize n) noexcept
+{
+    for (isize i = 0; i < n; ++i)
+    {
+        const f64 x = std::floor(f64(pSrc[i])*8388608.0 + f64(tpdf()) + 0.5);
+        pDst[i] = i32(utils::clamp(x, -8388608.0, 8388607.0)) * 256;
+    }
+}
+
+Resampler::Resampler(int nChannels)
+    : m_pCoeffs{Gpa::inst()->zallocV<f32>((N_PHASES + 1) * N_TAPS)},
+      m_pHistory{Gpa::inst()->zallocV<f32>(nChannels * HISTORY_CAP)},
+      m_pOut{Gpa::inst()->zallocV<f32>(nChannels * MAX_OUT_FRAMES)},
+      m_step{1.0},
+      m_nChannels{nChannels}
+{
+    ADT_ASSERT(nChannels > 0, "nChannels: {}", nChannels);
+    reset();
+}
+
+void
+Resampler::destroy() noexcept
+{
+    Gpa::inst()->free(m_pCoeffs);
+    Gpa::inst()->free(m_pHistory);
+    Gpa::inst()->free(m_pOut);
+
+    *this = {};
+}
+
+void
+Resampler::reset() noexcept
+{
+    /* N_TAPS/2 - 1 frames of silence so the first output is centered at the first input frame. */
+    m_nHistory = N_TAPS/2 - 1;
+    m_pos = 0.0;
+    utils::memSet(m_pHistory, 0, m_nChannels * HISTORY_CAP);
+}
+
+void
+Resampler::setStep(f64 step) noexcept
+{
+    constexpr f64 PI = 3.14159265358979323846;
+    constexpr f64 BETA = 8.6;
+    constexpr f64 HALF = N_TAPS / 2;
+    constexpr isize DELAY = N_TAPS/2 - 1;
+
+    m_step = step;
+
+    /* Lowpass below the lower nyquist, regenerating on every speed change is cheap enough. */
+    const f64 cutoff = utils::min(1.0, 1.0 / step) * 0.94;
+    if (std::abs(cutoff - m_cutoff) < 1e-4) return;
+    m_cutoff = cutoff;
+
+    const f64 i0Beta = besselI0(BETA);
+
+    for (isize phaseI = 0; phaseI <= N_PHASES; ++phaseI)
+    {
+        f32* pTaps = m_pCoeffs + phaseI*N_TAPS;
+        const f64 frac = f64(phaseI) / f64(N_PHASES);
+        f64 sum = 0.0;
+
+        for (isize k = 0; k < N_TAPS; ++k)
+        {
+            const f64 d = f64(k - DELAY) - frac;
+            const f64 x = cutoff * d;
+            const f64 sinc = std::abs(x) < 1e-9 ? 1.0 : std::sin(PI * x) / (PI * x);
+            const f64 r = d / HALF;
+            const f64 window = r*r < 1.0 ? besselI0(BETA * std::sqrt(1.0 - r*r)) / i0Beta : 0.0;
+
+            const f64 h = cutoff * sinc * window;
+            pTaps[k] = h;
+            sum += h;
+        }
+
+        /* Unity gain at DC for every phase. */
+        for (isize k = 0; k < N_TAPS; ++k) pTaps[k] /= sum;
+    }
+}
+
+Span<f32>
+Resampler::process(Span<const f32> spIn, isize* pnConsumed) noexcept
+{
+    const isize nChannels = m_nChannels;
+    const isize nInFrames = spIn.size() / nChannels;
+    isize nConsumed = 0;
+    isize nOut = 0;
+
+    alignas(32) f32 aTaps[N_TAPS];
+
+    while (true)
+    {
+        const isize nCopy = utils::min(nInFrames - nConsumed, HISTORY_CAP - m_nHistory);
+        for (isize chI = 0; chI < nChannels; ++chI)
+        {
+            f32* pHist = m_pHistory + chI*HISTORY_CAP + m_nHistory;
+            const f32* pIn = spIn.data() + nConsumed*nChannels + chI;
+            for (isize i = 0; i < nCopy; ++i) pHist[i] = pIn[i * nChannels];
+        }
+        m_nHistory += nCopy;
+        nConsumed += nCopy;
+
+        const isize nOutBefore = nOut;
+        while (nOut < MAX_OUT_FRAMES)
+        {
+            const isize i = isize(m_pos);
+            if (i + N_TAPS > m_nHistory) break;
+
+            const f64 phase = (m_pos - f64(i)) * N_PHASES;
+            const isize phaseI = isize(phase);
+            const f32* pTaps = m_pCoeffs + phaseI*N_TAPS;
+            lerp8(aTaps, pTaps, pTaps + N_TAPS, f32(phase - f64(phaseI)), N_TAPS);
+
+            for (isize chI = 0; chI < nChannels; ++chI)
+                m_pOut[nOut*nChannels + chI] = dot8(m_pHistory + chI*HISTORY_CAP + i, aTaps, N_TAPS);
+
+            ++nOut;
+            m_pos += m_step;
+        }
+
+        const isize nDrop = utils::min(isize(m_pos), m_nHistory);
+        if (nDrop > 0)
+        {
+            for (isize chI = 0; chI < nChannels; ++chI)
+            {
+                f32* pHist = m_pHistory + chI*HISTORY_CAP;
+                utils::memMove(pHist, pHist + nDrop, m_nHistory - nDrop);
+            }
+            m_nHistory -= nDrop;
+            m_pos -= f64(nDrop);
+        }
+
+        if (nOut >= MAX_OUT_FRAMES || (nCopy == 0 && nOut == nOutBefore)) break;
+    }
+
+    *pnConsumed = nConsumed * nChannels;
+    return {m_pOut, nOut * nChannels};
+}
+
+TimeStretch::TimeStretch(int nChannels, u32 sampleRate)
+    : m_sampleRate{sampleRate}, m_nChannels{nChannels}
+{
+    ADT_ASSERT(nChannels > 0, "nChannels: {}", nChannels);
+
+    /* 15-30ms window, power of two so the hop divides MAX_OUT_FRAMES and stays a multiple of 8 for dot8(). */
+    m_winSize = 256;
+    while (m_winSize*2 <= sampleRate * 0.03 && m_winSize < MAX_OUT_FRAMES*2) m_winSize *= 2;
+
+    m_hop = m_winSize / 2;
+    m_searchRadius = m_winSize / 4;
+    m_inCap = m_winSize*4 + m_hop*i64(MAX_TEMPO) + m_searchRadius*2;
+
+    m_pIn = Gpa::inst()->zallocV<f32>(m_inCap * nChannels);
+    m_pMono = Gpa::inst()->zallocV<f32>(m_inCap);
+    m_pWindow = Gpa::inst()->zallocV<f32>(m_winSize);
+    m_pOverlap = Gpa::inst()->zallocV<f32>(m_hop * nChannels);
+    m_pOut = Gpa::inst()->zallocV<f32>(MAX_OUT_FRAMES * nChannels);
+
+    /* Periodic Hann, w[i] + w[i + hop] == 1. */
+    constexpr f64 PI = 3.14159265358979323846;
+    for (isize i = 0; i < m_winSize; ++i)
+        m_pWindow[i] = 0.5 - 0.5*std::cos(2.0*PI*f64(i) / f64(m_winSize));
+
+    LogDebug{"TimeStretch: window: {}, hop: {}, radius: {}\n", m_winSize, m_hop, m_searchRadius};
+}
+
+void
+TimeStretch::destroy() noexcept
+{
+    Gpa::inst()->free(m_pIn);
+    Gpa::inst()->free(m_pMono);
+    Gpa::inst()->free(m_pWindow);
+    Gpa::inst()->free(m_pOverlap);
+    Gpa::inst()->free(m_pOut);
+
+    *this = {};
+}
+
+void
+TimeStretch::reset() noexcept
+{
+    m_nIn = 0;
+    m_anaPos = 0.0;
+    m_prevPos = 0;
+    m_bFirst = true;
+    utils::memSet(m_pOverlap, 0, m_hop * m_nChannels);
+}
+
+void
+TimeStretch::setTempo(f64 tempo) noexcept
+{
+    m_tempo = utils::clamp(tempo, MIN_TEMPO, MAX_TEMPO);
+}
+
+f32
+TimeStretch::similarity(isize refPos, isize pos) const noexcept
+{
+    const f32 corr = dot8(m_pMono + refPos, m_pMono + pos, m_hop);
+    const f32 energy = dot8(m_pMono + pos, m_pMono + pos, m_hop);
+    return corr / std::sqrt(energy + 1e-9f);
+}
+
+isize
+TimeStretch::findBestPos(isize nominal) const noexcept
+{
+    /* Natural continuation of the previous window is what the new one overlaps with. */
+    const isize refPos = m_prevPos + m_hop;
+    const isize lo = utils::max(nominal - m_searchRadius, isize(0));
+    const isize hi = nominal + m_searchRadius;
+
+    isize bestPos = nominal;
+    f32 bestScore = -std::numeric_limits<f32>::max();
+
+    for (isize pos = lo; pos <= hi; pos += SEARCH_STEP)
+    {
+        const f32 score = similarity(refPos, pos);
+        if (score > bestScore) bestScore = score, bestPos = pos;
+    }
+
+    const isize fineLo = utils::max(bestPos - SEARCH_STEP + 1, lo);
+    const isize fineHi = utils::min(bestPos + SEARCH_STEP - 1, hi);
+    for (isize pos = fineLo; pos <= fineHi; ++pos)
+    {
+        const f32 score = similarity(refPos, pos);
+        if (score > bestScore) bestScore = score, bestPos = pos;
+    }
+
+    return bestPos;
+}
+
+Span<f32>
+TimeStretch::process(Span<const f32> spIn, isize* pnConsumed) noexcept
+{
+    const isize nChannels = m_nChannels;
+    const isize nInFrames = spIn.size() / nChannels;
+    const f32 chScale = 1.0f / f32(nChannels);
+    isize nConsumed = 0;
+    isize nOut = 0;
+
+    while (nOut + m_hop <= MAX_OUT_FRAMES)
+    {
+        const isize nominal = isize(m_anaPos);
+        const isize nNeeded = nominal + m_searchRadius + m_winSize;
+
+        if (m_nIn < nNeeded)
+        {
+            const isize nCopy = utils::min(nInFrames - nConsumed, m_inCap - m_nIn);
+            if (nCopy <= 0) break;
+
+            const f32* pSrc = spIn.data() + nConsumed*nChannels;
+            utils::memCopy(m_pIn + m_nIn*nChannels, pSrc, nCopy * nChannels);
+
+            for (isize i = 0; i < nCopy; ++i)
+            {
+                f32 sum = 0.0f;
+                for (isize chI = 0; chI < nChannels; ++chI) sum += pSrc[i*nChannels + chI];
+                m_pMono[m_nIn + i] = sum * chScale;
+            }
+
+            m_nIn += nCopy;
+            nConsumed += nCopy;
+            continue;
+        }
+
+        const isize pos = m_bFirst ? nominal : findBestPos(nominal);
+        const f32* pWin = m_pIn + pos*nChannels;
+        f32* pDst = m_pOut + nOut*nChannels;
+
+        for (isize i = 0; i < m_hop; ++i)
+        {
+            const f32 wHead = m_pWindow[i];
+            const f32 wTail = m_pWindow[i + m_hop];
+
+            for (isize chI = 0; chI < nChannels; ++chI)
+            {
+                const isize sI = i*nChannels + chI;
+                pDst[sI] = m_pOverlap[sI] + wHead*pWin[sI];
+                m_pOverlap[sI] = wTail*pWin[m_hop*nChannels + sI];
+            }
+        }
+
+        nOut += m_hop;
+        m_prevPos = pos;
+        m_anaPos += f64(m_hop) * m_tempo;
+        m_bFirst = false;
+
+        /* Drop what neither the next search nor the next reference can reach. */
+        const isize nDrop = utils::min(isize(m_anaPos) - m_searchRadius, m_prevPos + m_hop);
+        if (nDrop > 0)
+        {
+            utils::memMove(m_pIn, m_pIn + nDrop*nChannels, (m_nIn - nDrop) * nChannels);
+            utils::memMove(m_pMono, m_pMono + nDrop, m_nIn - nDrop);
+            m_nIn -= nDrop;
+            m_anaPos -= f64(nDrop);
+            m_prevPos -= nDrop;
+        }
+    }
+
+    *pnConsumed = nConsumed * nChannels;
+    return {m_pOut, nOut * nChannels};
+}
+
+} /* namespace dsp */
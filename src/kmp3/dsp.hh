@@ -0,0 +1,387 @@
+#pragma once
+
+/* Small SIMD kernels for interleaved f32 blocks.
+ * Gated by ADT_AVX2/ADT_SSE4_2 (OPT_AVX2/OPT_SSE4_2), scalar loop handles the rest. */
+
+#if defined ADT_AVX2
+    #include <immintrin.h>
+#elif defined ADT_SSE4_2
+    #include <nmmintrin.h>
+#endif
+
+namespace dsp
+{
+
+/* pA[i] = pA[i]*pGainA[i] + pB[i]*pGainB[i] */
+inline void
+mixWeighted(f32* pA, const f32* pGainA, const f32* pB, const f32* pGainB, const isize n) noexcept
+{
+    isize i = 0;
+
+#ifdef ADT_AVX2
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m256 a = _mm256_mul_ps(_mm256_loadu_ps(pA + i), _mm256_loadu_ps(pGainA + i));
+        _mm256_storeu_ps(pA + i, _mm256_fmadd_ps(_mm256_loadu_ps(pB + i), _mm256_loadu_ps(pGainB + i), a));
+    }
+#endif
+
+#if defined ADT_AVX2 || defined ADT_SSE4_2
+    for (; i + 4 <= n; i += 4)
+    {
+        const __m128 a = _mm_mul_ps(_mm_loadu_ps(pA + i), _mm_loadu_ps(pGainA + i));
+        const __m128 b = _mm_mul_ps(_mm_loadu_ps(pB + i), _mm_loadu_ps(pGainB + i));
+        _mm_storeu_ps(pA + i, _mm_add_ps(a, b));
+    }
+#endif
+
+    for (; i < n; ++i)
+        pA[i] = pA[i]*pGainA[i] + pB[i]*pGainB[i];
+}
+
+/* sum(pA[i] * pB[i]), n is a multiple of 8. */
+inline f32
+dot8(const f32* pA, const f32* pB, const isize n) noexcept
+{
+#if defined ADT_AVX2
+    __m256 acc = _mm256_setzero_ps();
+    for (isize i = 0; i < n; i += 8)
+        acc = _mm256_fmadd_ps(_mm256_loadu_ps(pA + i), _mm256_loadu_ps(pB + i), acc);
+
+    __m128 sum = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+#elif defined ADT_SSE4_2
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    for (isize i = 0; i < n; i += 8)
+    {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(pA + i), _mm_loadu_ps(pB + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(pA + i + 4), _mm_loadu_ps(pB + i + 4)));
+    }
+
+    __m128 sum = _mm_add_ps(acc0, acc1);
+    sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+    sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+    return _mm_cvtss_f32(sum);
+#else
+    f32 aAcc[8] {};
+    for (isize i = 0; i < n; i += 8)
+        for (isize j = 0; j < 8; ++j) aAcc[j] += pA[i + j] * pB[i + j];
+
+    return (aAcc[0] + aAcc[1]) + (aAcc[2] + aAcc[3]) + (aAcc[4] + aAcc[5]) + (aAcc[6] + aAcc[7]);
+#endif
+}
+
+/* pDst[i] = pA[i] + t*(pB[i] - pA[i]), n is a multiple of 8. */
+inline void
+lerp8(f32* pDst, const f32* pA, const f32* pB, const f32 t, const isize n) noexcept
+{
+#if defined ADT_AVX2
+    const __m256 vt = _mm256_set1_ps(t);
+    for (isize i = 0; i < n; i += 8)
+    {
+        const __m256 a = _mm256_loadu_ps(pA + i);
+        _mm256_storeu_ps(pDst + i, _mm256_fmadd_ps(_mm256_sub_ps(_mm256_loadu_ps(pB + i), a), vt, a));
+    }
+#elif defined ADT_SSE4_2
+    const __m128 vt = _mm_set1_ps(t);
+    for (isize i = 0; i < n; i += 4)
+    {
+        const __m128 a = _mm_loadu_ps(pA + i);
+        _mm_storeu_ps(pDst + i, _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(pB + i), a), vt)));
+    }
+#else
+    for (isize i = 0; i < n; ++i)
+        pDst[i] = pA[i] + t*(pB[i] - pA[i]);
+#endif
+}
+
+/* p[i] *= gain */
+inline void
+scale(f32* p, const f32 gain, const isize n) noexcept
+{
+    isize i = 0;
+
+#ifdef ADT_AVX2
+    const __m256 vGain8 = _mm256_set1_ps(gain);
+    for (; i + 8 <= n; i += 8)
+        _mm256_storeu_ps(p + i, _mm256_mul_ps(_mm256_loadu_ps(p + i), vGain8));
+#endif
+
+#if defined ADT_AVX2 || defined ADT_SSE4_2
+    const __m128 vGain4 = _mm_set1_ps(gain);
+    for (; i + 4 <= n; i += 4)
+        _mm_storeu_ps(p + i, _mm_mul_ps(_mm_loadu_ps(p + i), vGain4));
+#endif
+
+    for (; i < n; ++i)
+        p[i] *= gain;
+}
+
+/* Frame i of interleaved p is scaled by (gain + step*i).
+ * N_CHANNELS that divide the vector width get SIMD lanes laid out per frame, N_CHANNELS == 0 is the runtime nChannels fallback. */
+template<int N_CHANNELS>
+inline void
+scaleRamp(f32* p, const isize nFrames, const int nChannels, const f32 gain, const f32 step) noexcept
+{
+    const int nCh = N_CHANNELS > 0 ? N_CHANNELS : nChannels;
+    isize frameI = 0;
+
+#if defined ADT_AVX2
+    if constexpr (N_CHANNELS > 0 && 8 % N_CHANNELS == 0)
+    {
+        constexpr isize FRAMES = 8 / N_CHANNELS;
+        alignas(32) f32 aOff[8];
+        for (int i = 0; i < 8; ++i) aOff[i] = f32(i / N_CHANNELS);
+
+        const __m256 vOff = _mm256_load_ps(aOff);
+        const __m256 vGain = _mm256_set1_ps(gain);
+        const __m256 vStep = _mm256_set1_ps(step);
+        for (; frameI + FRAMES <= nFrames; frameI += FRAMES)
+        {
+            const __m256 g = _mm256_fmadd_ps(_mm256_add_ps(_mm256_set1_ps(f32(frameI)), vOff), vStep, vGain);
+            f32* pI = p + frameI*N_CHANNELS;
+            _mm256_storeu_ps(pI, _mm256_mul_ps(_mm256_loadu_ps(pI), g));
+        }
+    }
+#elif defined ADT_SSE4_2
+    if constexpr (N_CHANNELS > 0 && 4 % N_CHANNELS == 0)
+    {
+        constexpr isize FRAMES = 4 / N_CHANNELS;
+        alignas(16) f32 aOff[4];
+        for (int i = 0; i < 4; ++i) aOff[i] = f32(i / N_CHANNELS);
+
+        const __m128 vOff = _mm_load_ps(aOff);
+        const __m128 vGain = _mm_set1_ps(gain);
+        const __m128 vStep = _mm_set1_ps(step);
+        for (; frameI + FRAMES <= nFrames; frameI += FRAMES)
+        {
+            const __m128 g = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_set1_ps(f32(frameI)), vOff), vStep), vGain);
+            f32* pI = p + frameI*N_CHANNELS;
+            _mm_storeu_ps(pI, _mm_mul_ps(_mm_loadu_ps(pI), g));
+        }
+    }
+#endif
+
+    for (; frameI < nFrames; ++frameI)
+    {
+        const f32 g = gain + step*f32(frameI);
+        for (int chI = 0; chI < nCh; ++chI) p[frameI*nCh + chI] *= g;
+    }
+}
+
+/* Below KNEE untouched, above it |x| bends smoothly towards 1.0 (first derivative stays continuous). */
+inline void
+softClip(f32* p, const f32 knee, const isize n) noexcept
+{
+    const f32 invRange = 1.0f / (1.0f - knee);
+    isize i = 0;
+
+#if defined ADT_AVX2
+    const __m256 vSign8 = _mm256_set1_ps(-0.0f);
+    const __m256 vKnee8 = _mm256_set1_ps(knee);
+    const __m256 vInv8 = _mm256_set1_ps(invRange);
+    const __m256 vOne8 = _mm256_set1_ps(1.0f);
+    const __m256 vZero8 = _mm256_setzero_ps();
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m256 x = _mm256_loadu_ps(p + i);
+        const __m256 ax = _mm256_andnot_ps(vSign8, x);
+        const __m256 d = _mm256_max_ps(_mm256_sub_ps(ax, vKnee8), vZero8);
+        const __m256 y = _mm256_add_ps(_mm256_min_ps(ax, vKnee8), _mm256_div_ps(d, _mm256_fmadd_ps(d, vInv8, vOne8)));
+        _mm256_storeu_ps(p + i, _mm256_or_ps(y, _mm256_and_ps(vSign8, x)));
+    }
+#endif
+
+#if defined ADT_AVX2 || defined ADT_SSE4_2
+    const __m128 vSign4 = _mm_set1_ps(-0.0f);
+    const __m128 vKnee4 = _mm_set1_ps(knee);
+    const __m128 vInv4 = _mm_set1_ps(invRange);
+    const __m128 vOne4 = _mm_set1_ps(1.0f);
+    const __m128 vZero4 = _mm_setzero_ps();
+    for (; i + 4 <= n; i += 4)
+    {
+        const __m128 x = _mm_loadu_ps(p + i);
+        const __m128 ax = _mm_andnot_ps(vSign4, x);
+        const __m128 d = _mm_max_ps(_mm_sub_ps(ax, vKnee4), vZero4);
+        const __m128 y = _mm_add_ps(_mm_min_ps(ax, vKnee4), _mm_div_ps(d, _mm_add_ps(_mm_mul_ps(d, vInv4), vOne4)));
+        _mm_storeu_ps(p + i, _mm_or_ps(y, _mm_and_ps(vSign4, x)));
+    }
+#endif
+
+    for (; i < n; ++i)
+    {
+        const f32 ax = p[i] < 0.0f ? -p[i] : p[i];
+        const f32 d = utils::max(ax - knee, 0.0f);
+        const f32 y = utils::min(ax, knee) + d / (1.0f + d*invRange);
+        p[i] = p[i] < 0.0f ? -y : y;
+    }
+}
+
+/* Integer samples to f32 in [-1, 1). */
+inline void
+fromS16(f32* pDst, const i16* pSrc, const isize n) noexcept
+{
+    for (isize i = 0; i < n; ++i) pDst[i] = f32(pSrc[i]) * (1.0f / 32768.0f);
+}
+
+inline void
+fromS32(f32* pDst, const i32* pSrc, const isize n) noexcept
+{
+    for (isize i = 0; i < n; ++i) pDst[i] = f32(pSrc[i]) * (1.0f / 2147483648.0f);
+}
+
+/* Back to integers with TPDF dither (sum of two uniform randoms, +-1 LSB), clamped to the full range.
+ * S32 is dithered at 24 bits: what f32 carries, and what S32 devices actually convert. */
+struct Dither
+{
+    u32 m_state = 0x9e3779b9u; /* xorshift32, never 0. */
+
+    /* */
+
+    void toS16(i16* pDst, const f32* pSrc, isize n) noexcept;
+    void toS32(i32* pDst, const f32* pSrc, isize n) noexcept;
+
+protected:
+    [[nodiscard]] f32 tpdf() noexcept; /* In LSBs. */
+};
+
+/* Block processor of the decoder side chain, works in place on interleaved f32. */
+struct IProcessor
+{
+    virtual void process(Span<f32> sp, int nChannels) noexcept = 0;
+    virtual void reset() noexcept {}
+};
+
+/* Ordered list of processors, each block goes through all of them right before the ring buffer. */
+struct Chain
+{
+    static constexpr isize MAX_PROCESSORS = 8;
+
+    Array<IProcessor*, MAX_PROCESSORS> m_aProcessors {};
+
+    /* */
+
+    void push(IProcessor* pProcessor) noexcept;
+    void clear() noexcept;
+    void reset() noexcept;
+    void process(Span<f32> sp, int nChannels) noexcept;
+};
+
+/* Volume, changes of the target are ramped over m_rampFrames to avoid zipper noise. */
+struct Gain : IProcessor
+{
+    f32 m_gain = 1.0f;
+    f32 m_target = 1.0f;
+    f32 m_step {}; /* Per frame. */
+    isize m_rampLeft {};
+    isize m_rampFrames = 480;
+
+    /* */
+
+    Gain() = default;
+    Gain(u32 sampleRate, f64 rampMs);
+
+    /* */
+
+    void setTarget(f32 target) noexcept;
+    [[nodiscard]] bool isUnity() const noexcept { return m_rampLeft == 0 && m_gain == 1.0f; }
+    virtual void process(Span<f32> sp, int nChannels) noexcept override;
+    virtual void reset() noexcept override; /* Jumps straight to the target. */
+};
+
+/* Keeps gains above unity (maxVolume > 100) from hard clipping. */
+struct SoftClip : IProcessor
+{
+    static constexpr f32 KNEE = 0.8f;
+
+    bool m_bEnabled = false;
+
+    /* */
+
+    virtual void process(Span<f32> sp, int nChannels) noexcept override;
+};
+
+/* Polyphase windowed-sinc resampler for interleaved f32 with arbitrary (changing) ratio.
+ * Kaiser windowed taps are tabulated for N_PHASES fractional offsets and linearly interpolated in between.
+ * History is kept planar per channel so the state stays continuous across process() calls. */
+struct Resampler
+{
+    static constexpr isize N_TAPS = 32;
+    static constexpr isize N_PHASES = 256;
+    static constexpr isize MAX_OUT_FRAMES = 2048; /* Per process() call. */
+    static constexpr isize HISTORY_CAP = N_TAPS + 1024;
+
+    f32* m_pCoeffs {}; /* (N_PHASES + 1) * N_TAPS */
+    f32* m_pHistory {}; /* nChannels * HISTORY_CAP */
+    f32* m_pOut {}; /* nChannels * MAX_OUT_FRAMES */
+    f64 m_step {}; /* Input frames per output frame. */
+    f64 m_pos {}; /* Fractional read position in the history. */
+    f64 m_cutoff {};
+    isize m_nHistory {};
+    int m_nChannels {};
+
+    /* */
+
+    Resampler() = default;
+    Resampler(int nChannels);
+
+    /* */
+
+    void destroy() noexcept;
+    void reset() noexcept; /* Drops the history. */
+    void setStep(f64 step) noexcept; /* inRate / outRate. */
+
+    /* Returns span into m_pOut (free to modify until the next call), *pnConsumed is how much of spIn was taken (the rest is for the next call). */
+    [[nodiscard]] Span<f32> process(Span<const f32> spIn, isize* pnConsumed) noexcept;
+};
+
+/* WSOLA time-stretch, changes tempo without touching pitch.
+ * Hann windows (~25ms) are overlap-added at half window hops, each next window is taken within m_searchRadius
+ * of its nominal position, where it correlates best with the natural continuation of the previous one.
+ * Correlation runs on a mono downmix, coarse every SEARCH_STEP frames then refined around the best one,
+ * so the cost per output hop is bounded regardless of the tempo. */
+struct TimeStretch
+{
+    static constexpr f64 MIN_TEMPO = 0.25;
+    static constexpr f64 MAX_TEMPO = 4.0; /* Anything faster is left to the resampler. */
+    static constexpr isize MAX_OUT_FRAMES = 2048; /* Per process() call, multiple of any m_hop. */
+    static constexpr isize SEARCH_STEP = 4;
+
+    f32* m_pIn {}; /* Interleaved, m_inCap frames. */
+    f32* m_pMono {}; /* m_inCap frames. */
+    f32* m_pWindow {}; /* m_winSize */
+    f32* m_pOverlap {}; /* Interleaved, second half of the previous window. */
+    f32* m_pOut {}; /* Interleaved, MAX_OUT_FRAMES. */
+    f64 m_tempo = 1.0;
+    f64 m_anaPos {}; /* Nominal position of the next window in m_pIn. */
+    isize m_prevPos {}; /* Where the previous window was taken from. */
+    isize m_nIn {};
+    isize m_inCap {};
+    isize m_winSize {};
+    isize m_hop {};
+    isize m_searchRadius {};
+    u32 m_sampleRate {};
+    int m_nChannels {};
+    bool m_bFirst = true;
+
+    /* */
+
+    TimeStretch() = default;
+    TimeStretch(int nChannels, u32 sampleRate);
+
+    /* */
+
+    void destroy() noexcept;
+    void reset() noexcept;
+    void setTempo(f64 tempo) noexcept;
+    [[nodiscard]] Span<f32> process(Span<const f32> spIn, isize* pnConsumed) noexcept; /* Same contract as Resampler::process(). */
+
+protected:
+    [[nodiscard]] isize findBestPos(isize nominal) const noexcept;
+    [[nodiscard]] f32 similarity(isize refPos, isize pos) const noexcept;
+};
+
+} /* namespace dsp */
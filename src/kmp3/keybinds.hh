@@ -75,12 +75,14 @@ inline const Key inl_aKeys[] {
     {{},               L']',  (void*)app::changeSampleRateUp,    {U64_BOOL, {.ub {1000, false}}}},
     {{},               L'}',  (void*)app::changeSampleRateUp,    {U64_BOOL, {.ub {100, false}}} },
     {{},               L'\\', (void*)app::restoreSampleRate,     NONE                           },
+    {{},               L'P',  (void*)app::togglePreservePitch,   NONE                           },
     {keys::ARROWLEFT,  L'h',  (void*)app::seekOff,               {F64, {.d = -10000.0}}         },
     {{},               L'H',  (void*)app::seekOff,               {F64, {.d = -1000.0}}          },
     {keys::ARROWRIGHT, L'l',  (void*)app::seekOff,               {F64, {.d = 10000.0}}          },
     {{},               L'L',  (void*)app::seekOff,               {F64, {.d = 1000.0}}           },
     {{},               L'r',  (void*)app::cycleRepeatMethods,    {BOOL, {.b = true}}            },
     {{},               L'R',  (void*)app::cycleRepeatMethods,    {BOOL, {.b = false}}           },
+    {{},               L'a',  (void*)app::markAbLoop,            NONE                           },
     {{},               L'm',  (void*)app::toggleMute,            NONE                           },
     {{},               L't',  (void*)app::seekFromInput,         NONE                           },
     {{},               L'p',  (void*)app::selectPrev,            NONE                           },
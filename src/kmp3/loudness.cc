@@ -0,0 +1,570 @@
+#include "loudness.hh"
+
+#include "app.hh"
+
+#include <cmath>
+#include <sys/stat.h>
+
+#if defined ADT_AVX2
+    #include <immintrin.h>
+#elif defined ADT_SSE4_2
+    #include <nmmintrin.h>
+#endif
+
+namespace loudness
+{
+
+/* Meter::MAX_CHANNELS lanes, loads and stores are 32 byte aligned. */
+struct Lanes
+{
+#if defined ADT_AVX2
+    __m256 v;
+#elif defined ADT_SSE4_2
+    __m128 lo, hi;
+#else
+    f32 a[8];
+#endif
+};
+
+static_assert(Meter::MAX_CHANNELS == 8);
+
+#if defined ADT_AVX2
+
+static inline Lanes lanesLoad(const f32* p) noexcept { return {_mm256_load_ps(p)}; }
+static inline void lanesStore(f32* p, const Lanes x) noexcept { _mm256_store_ps(p, x.v); }
+static inline Lanes lanesSet1(const f32 x) noexcept { return {_mm256_set1_ps(x)}; }
+static inline Lanes lanesMax(const Lanes a, const Lanes b) noexcept { return {_mm256_max_ps(a.v, b.v)}; }
+static inline Lanes lanesAbs(const Lanes a) noexcept { return {_mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v)}; }
+/* a*b + c */
+static inline Lanes lanesMulAdd(const Lanes a, const Lanes b, const Lanes c) noexcept { return {_mm256_fmadd_ps(a.v, b.v, c.v)}; }
+
+#elif defined ADT_SSE4_2
+
+static inline Lanes lanesLoad(const f32* p) noexcept { return {_mm_load_ps(p), _mm_load_ps(p + 4)}; }
+static inline void lanesStore(f32* p, const Lanes x) noexcept { _mm_store_ps(p, x.lo); _mm_store_ps(p + 4, x.hi); }
+static inline Lanes lanesSet1(const f32 x) noexcept { return {_mm_set1_ps(x), _mm_set1_ps(x)}; }
+static inline Lanes lanesMax(const Lanes a, const Lanes b) noexcept { return {_mm_max_ps(a.lo, b.lo), _mm_max_ps(a.hi, b.hi)}; }
+
+static inline Lanes
+lanesAbs(const Lanes a) noexcept
+{
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    return {_mm_andnot_ps(sign, a.lo), _mm_andnot_ps(sign, a.hi)};
+}
+
+static inline Lanes
+lanesMulAdd(const Lanes a, const Lanes b, const Lanes c) noexcept
+{
+    return {_mm_add_ps(_mm_mul_ps(a.lo, b.lo), c.lo), _mm_add_ps(_mm_mul_ps(a.hi, b.hi), c.hi)};
+}
+
+#else
+
+static inline Lanes
+lanesLoad(const f32* p) noexcept
+{
+    Lanes r;
+    for (int i = 0; i < 8; ++i) r.a[i] = p[i];
+    return r;
+}
+
+static inline void
+lanesStore(f32* p, const Lanes x) noexcept
+{
+    for (int i = 0; i < 8; ++i) p[i] = x.a[i];
+}
+
+static inline Lanes
+lanesSet1(const f32 x) noexcept
+{
+    Lanes r;
+    for (int i = 0; i < 8; ++i) r.a[i] = x;
+    return r;
+}
+
+static inline Lanes
+lanesMax(const Lanes a, const Lanes b) noexcept
+{
+    Lanes r;
+    for (int i = 0; i < 8; ++i) r.a[i] = utils::max(a.a[i], b.a[i]);
+    return r;
+}
+
+static inline Lanes
+lanesAbs(const Lanes a) noexcept
+{
+    Lanes r;
+    for (int i = 0; i < 8; ++i) r.a[i] = a.a[i] < 0.0f ? -a.a[i] : a.a[i];
+    return r;
+}
+
+static inline Lanes
+lanesMulAdd(const Lanes a, const Lanes b, const Lanes c) noexcept
+{
+    Lanes r;
+    for (int i = 0; i < 8; ++i) r.a[i] = a.a[i]*b.a[i] + c.a[i];
+    return r;
+}
+
+#endif
+
+static inline Lanes lanesMul(const Lanes a, const Lanes b) noexcept { return lanesMulAdd(a, b, lanesSet1(0.0f)); }
+
+/* y = b0*x + s1; s1 = b1*x - a1*y + s2; s2 = b2*x - a2*y (aCoeffs holds -a1, -a2). */
+static inline Lanes
+biquad(const Lanes x, const Lanes (&aCoeffs)[5], Lanes* pS1, Lanes* pS2) noexcept
+{
+    const Lanes y = lanesMulAdd(aCoeffs[0], x, *pS1);
+    *pS1 = lanesMulAdd(aCoeffs[3], y, lanesMulAdd(aCoeffs[1], x, *pS2));
+    *pS2 = lanesMulAdd(aCoeffs[4], y, lanesMul(aCoeffs[2], x));
+    return y;
+}
+
+Meter::Meter(int nChannels, u32 sampleRate)
+    : m_subBlockFrames {utils::max(isize(std::round(f64(sampleRate) * 0.1)), isize(1))},
+      m_nChannels {utils::min(nChannels, MAX_CHANNELS)}
+{
+    const f64 fs = sampleRate;
+
+    /* BS.1770 pre-filter and RLB weighting, re-derived for any sample rate. */
+    {
+        const f64 f0 = 1681.974450955533;
+        const f64 g = 3.999843853973347;
+        const f64 q = 0.7071752369554196;
+
+        const f64 k = std::tan(M_PI * f0 / fs);
+        const f64 vh = std::pow(10.0, g / 20.0);
+        const f64 vb = std::pow(vh, 0.4996667741545416);
+        const f64 a0 = 1.0 + k/q + k*k;
+
+        m_aShelf[0] = (vh + vb*k/q + k*k) / a0;
+        m_aShelf[1] = 2.0 * (k*k - vh) / a0;
+        m_aShelf[2] = (vh - vb*k/q + k*k) / a0;
+        m_aShelf[3] = 2.0 * (k*k - 1.0) / a0;
+        m_aShelf[4] = (1.0 - k/q + k*k) / a0;
+    }
+    {
+        const f64 f0 = 38.13547087602444;
+        const f64 q = 0.5003270373238773;
+
+        const f64 k = std::tan(M_PI * f0 / fs);
+        const f64 a0 = 1.0 + k/q + k*k;
+
+        m_aHighPass[0] = 1.0;
+        m_aHighPass[1] = -2.0;
+        m_aHighPass[2] = 1.0;
+        m_aHighPass[3] = 2.0 * (k*k - 1.0) / a0;
+        m_aHighPass[4] = (1.0 - k/q + k*k) / a0;
+    }
+
+    /* L, R, C, LFE, Ls, Rs for 5.1, LFE doesn't count, surrounds are +1.5dB. */
+    for (int i = 0; i < m_nChannels; ++i) m_aWeights[i] = 1.0f;
+    if (m_nChannels == 6)
+    {
+        m_aWeights[3] = 0.0f;
+        m_aWeights[4] = m_aWeights[5] = 1.41f;
+    }
+
+    /* Blackman windowed sinc cut at the original Nyquist, split into phases, each normalized to unity DC gain. */
+    constexpr isize N = N_PEAK_PHASES * N_PEAK_TAPS;
+    f64 aH[N] {};
+    for (isize i = 0; i < N; ++i)
+    {
+        const f64 t = (f64(i) - f64(N - 1) * 0.5) / f64(N_PEAK_PHASES);
+        const f64 sinc = t == 0.0 ? 1.0 : std::sin(M_PI * t) / (M_PI * t);
+        const f64 w = 0.42 - 0.5*std::cos(2.0*M_PI * (f64(i) + 0.5) / f64(N)) + 0.08*std::cos(4.0*M_PI * (f64(i) + 0.5) / f64(N));
+        aH[i] = sinc * w;
+    }
+
+    for (isize phaseI = 0; phaseI < N_PEAK_PHASES; ++phaseI)
+    {
+        f64 sum = 0.0;
+        for (isize k = 0; k < N_PEAK_TAPS; ++k) sum += aH[phaseI + k*N_PEAK_PHASES];
+
+        /* Tap k multiplies the sample k frames back, history is stored oldest first. */
+        for (isize k = 0; k < N_PEAK_TAPS; ++k)
+            m_aaPeakCoeffs[phaseI][N_PEAK_TAPS - 1 - k] = aH[phaseI + k*N_PEAK_PHASES] / sum;
+    }
+}
+
+void
+Meter::destroy() noexcept
+{
+    m_vBlocks.destroy();
+}
+
+void
+Meter::process(Span<const f32> sp) noexcept
+{
+    const int nChannels = m_nChannels;
+
+    /* a1, a2 negated for biquad(). */
+    Lanes aShelf[5], aHighPass[5];
+    for (int i = 0; i < 5; ++i)
+    {
+        aShelf[i] = lanesSet1(i < 3 ? m_aShelf[i] : -m_aShelf[i]);
+        aHighPass[i] = lanesSet1(i < 3 ? m_aHighPass[i] : -m_aHighPass[i]);
+    }
+
+    Lanes aaCoeffs[N_PEAK_PHASES][N_PEAK_TAPS];
+    for (isize phaseI = 0; phaseI < N_PEAK_PHASES; ++phaseI)
+        for (isize k = 0; k < N_PEAK_TAPS; ++k)
+            aaCoeffs[phaseI][k] = lanesSet1(m_aaPeakCoeffs[phaseI][k]);
+
+    Lanes s1 = lanesLoad(m_aaState[0]);
+    Lanes s2 = lanesLoad(m_aaState[1]);
+    Lanes s3 = lanesLoad(m_aaState[2]);
+    Lanes s4 = lanesLoad(m_aaState[3]);
+    Lanes energy = lanesLoad(m_aEnergy);
+    Lanes peak = lanesLoad(m_aPeak);
+
+    alignas(32) f32 aFrame[MAX_CHANNELS] {};
+    const isize nFrames = sp.size() / nChannels;
+
+    for (isize frameI = 0; frameI < nFrames; ++frameI)
+    {
+        for (int chI = 0; chI < nChannels; ++chI) aFrame[chI] = sp[frameI*nChannels + chI];
+        const Lanes x = lanesLoad(aFrame);
+
+        const Lanes y = biquad(biquad(x, aShelf, &s1, &s2), aHighPass, &s3, &s4);
+        energy = lanesMulAdd(y, y, energy);
+
+        lanesStore(m_aaHistory[m_historyPos], x);
+        lanesStore(m_aaHistory[m_historyPos + N_PEAK_TAPS], x);
+        m_historyPos = m_historyPos + 1 < N_PEAK_TAPS ? m_historyPos + 1 : 0;
+
+        /* m_historyPos is the oldest now. */
+        const f32 (*aaWindow)[MAX_CHANNELS] = m_aaHistory + m_historyPos;
+        for (isize phaseI = 0; phaseI < N_PEAK_PHASES; ++phaseI)
+        {
+            Lanes acc = lanesSet1(0.0f);
+            for (isize k = 0; k < N_PEAK_TAPS; ++k)
+                acc = lanesMulAdd(aaCoeffs[phaseI][k], lanesLoad(aaWindow[k]), acc);
+            peak = lanesMax(peak, lanesAbs(acc));
+        }
+
+        if (++m_subBlockPos >= m_subBlockFrames)
+        {
+            lanesStore(m_aEnergy, energy);
+            finishSubBlock();
+            energy = lanesSet1(0.0f);
+        }
+    }
+
+    lanesStore(m_aaState[0], s1);
+    lanesStore(m_aaState[1], s2);
+    lanesStore(m_aaState[2], s3);
+    lanesStore(m_aaState[3], s4);
+    lanesStore(m_aEnergy, energy);
+    lanesStore(m_aPeak, peak);
+}
+
+void
+Meter::finishSubBlock() noexcept
+{
+    f64 weighted = 0.0;
+    for (int chI = 0; chI < m_nChannels; ++chI) weighted += f64(m_aWeights[chI]) * f64(m_aEnergy[chI]);
+
+    m_aSubBlocks[m_nSubBlocks % 4] = weighted;
+    ++m_nSubBlocks;
+    m_subBlockPos = 0;
+
+    if (m_nSubBlocks >= 4)
+    {
+        const f64 sum = m_aSubBlocks[0] + m_aSubBlocks[1] + m_aSubBlocks[2] + m_aSubBlocks[3];
+        m_vBlocks.push(f32(sum / f64(4 * m_subBlockFrames)));
+    }
+}
+
+f64
+Meter::integrated() const noexcept
+{
+    static const f64 s_absGate = std::pow(10.0, (SILENCE_LUFS + 0.691) / 10.0);
+
+    f64 sum = 0.0;
+    isize n = 0;
+    for (const f32 power : m_vBlocks)
+        if (power > s_absGate) sum += power, ++n;
+
+    if (n == 0) return SILENCE_LUFS;
+
+    /* Relative gate is 10 LU below the absolute-gated loudness. */
+    const f64 gate = utils::max(s_absGate, (sum / f64(n)) * 0.1);
+    sum = 0.0;
+    n = 0;
+    for (const f32 power : m_vBlocks)
+        if (power > gate) sum += power, ++n;
+
+    if (n == 0) return SILENCE_LUFS;
+
+    return -0.691 + 10.0*std::log10(sum / f64(n));
+}
+
+f32
+Meter::truePeak() const noexcept
+{
+    f32 peak = 0.0f;
+    for (int chI = 0; chI < m_nChannels; ++chI) peak = utils::max(peak, m_aPeak[chI]);
+    return peak;
+}
+
+f32
+Result::gain(f64 targetLufs) const noexcept
+{
+    if (lufs <= Meter::SILENCE_LUFS) return 1.0f;
+
+    f64 gain = std::pow(10.0, (targetLufs - f64(lufs)) / 20.0);
+    if (peak > 0.0f) gain = utils::min(gain, 1.0 / f64(peak));
+
+    return f32(gain);
+}
+
+void
+Scanner::start(Span<const StringView> spPaths)
+{
+    new(&m_mtx) Mutex {Mutex::TYPE::PLAIN};
+    new(&m_mCached) Map<StringView, Result> {Gpa::inst()};
+    new(&m_mReady) Map<StringView, Result> {Gpa::inst(), spPaths.size() * 2};
+    m_spPaths = spPaths;
+
+    const StringView svDir = app::cacheDir();
+    if (svDir.size() > 0)
+    {
+        char aPath[1024] {};
+        const isize n = print::toBuffer(aPath, sizeof(aPath) - 1, "{}/loudness", svDir);
+        aPath[n] = '\0';
+
+        loadCache({aPath, n});
+        m_pCacheFile = fopen(aPath, "ab");
+        if (!m_pCacheFile) LogWarn{"failed to open '{}': {}\n", aPath, strerror(errno)};
+    }
+
+    m_bStarted = true;
+    new(&m_thrd) Thread {
+        [](void* p) { return static_cast<Scanner*>(p)->loop(); },
+        this
+    };
+}
+
+void
+Scanner::destroy() noexcept
+{
+    if (!m_bStarted) return;
+
+    m_atom_bQuit.store(true, atomic::ORDER::RELEASE);
+    m_thrd.join();
+
+    if (m_pCacheFile) fclose(m_pCacheFile);
+    m_mCached.destroy(Gpa::inst());
+    m_mReady.destroy(Gpa::inst());
+    m_sCache.destroy(Gpa::inst());
+    m_mtx.destroy();
+    m_bStarted = false;
+}
+
+bool
+Scanner::find(StringView svPath, Result* pRes)
+{
+    if (!m_bStarted) return false;
+
+    LockScope lock {&m_mtx};
+
+    auto found = m_mReady.search(svPath);
+    if (!found) return false;
+
+    *pRes = found.value();
+    return true;
+}
+
+THREAD_STATUS
+Scanner::loop()
+{
+    const time::Type t0 = time::nowUS();
+
+    /* Workers and this thread all pull the next index, so every core is busy until the list ends. */
+    ThreadPool pool {Arena{}, 64, SIZE_1M, IThreadPool::optimalThreadCount()};
+    for (int i = 0; i < pool.nThreads(); ++i)
+        pool.addRetry([this] { scanLoop(); });
+
+    scanLoop();
+    pool.destroy();
+
+    if (m_pCacheFile)
+    {
+        LockScope lock {&m_mtx};
+        fflush(m_pCacheFile);
+    }
+
+    LogInfo{"loudness: measured {} of {} songs in {} ms\n",
+        m_atom_nScanned.load(atomic::ORDER::RELAXED), m_spPaths.size(), (time::nowUS() - t0) / 1000
+    };
+
+    return THREAD_STATUS(0);
+}
+
+void
+Scanner::scanLoop()
+{
+    while (!m_atom_bQuit.load(atomic::ORDER::ACQUIRE))
+    {
+        const isize i = m_atom_nextI.fetchAdd(1, atomic::ORDER::RELAXED);
+        if (i >= m_spPaths.size()) break;
+
+        scan(m_spPaths[i]);
+    }
+}
+
+void
+Scanner::scan(StringView svPath)
+{
+    char aPath[4096];
+    if (svPath.size() >= isize(sizeof(aPath))) return;
+    utils::memCopy(aPath, svPath.data(), svPath.size());
+    aPath[svPath.size()] = '\0';
+
+    struct stat st {};
+    if (stat(aPath, &st) != 0) return;
+
+    Result res {.size = i64(st.st_size), .mtime = i64(st.st_mtime)};
+
+    {
+        LockScope lock {&m_mtx};
+
+        auto cached = m_mCached.search(svPath);
+        if (cached && cached.value().size == res.size && cached.value().mtime == res.mtime)
+        {
+            m_mReady.insert(Gpa::inst(), svPath, cached.value());
+            return;
+        }
+    }
+
+    platform::ffmpeg::Decoder dec {};
+    dec.m_bNoCover = true;
+    if (app::streamInfoCache().m_bStarted) dec.m_pInfoCache = &app::streamInfoCache();
+    defer( dec.close() );
+
+    if (dec.open(svPath) != audio::ERROR::OK_) return;
+
+    Meter meter {dec.getChannelsCount(), dec.getSampleRate()};
+    defer( meter.destroy() );
+
+    const isize nChannels = dec.getChannelsCount();
+    f32 aBuff[4096];
+    const isize blockSize = (utils::size(aBuff) / nChannels) * nChannels;
+
+    for (;;)
+    {
+        if (m_atom_bQuit.load(atomic::ORDER::RELAXED)) return;
+
+        isize nRead = 0;
+        const audio::ERROR err = dec.readSamples({aBuff, blockSize}, &nRead);
+
+        /* Only the measured channels, the rest is skipped per frame. */
+        if (nChannels > Meter::MAX_CHANNELS)
+        {
+            const isize nFrames = nRead / nChannels;
+            for (isize frameI = 0; frameI < nFrames; ++frameI)
+                utils::memMove(aBuff + frameI*Meter::MAX_CHANNELS, aBuff + frameI*nChannels, Meter::MAX_CHANNELS);
+            nRead = nFrames * Meter::MAX_CHANNELS;
+        }
+
+        meter.process({aBuff, nRead});
+
+        if (err != audio::ERROR::OK_) break;
+    }
+
+    res.lufs = meter.integrated();
+    res.peak = meter.truePeak();
+    m_atom_nScanned.fetchAdd(1, atomic::ORDER::RELAXED);
+
+    LogDebug{"loudness: '{}': {} LUFS, peak: {}\n", svPath, res.lufs, res.peak};
+
+    LockScope lock {&m_mtx};
+
+    m_mReady.insert(Gpa::inst(), svPath, res);
+    if (m_pCacheFile) writeLine(m_pCacheFile, svPath, res);
+}
+
+void
+Scanner::writeLine(FILE* pFile, StringView svPath, const Result& res)
+{
+    char aLine[4096 + 128];
+    const isize n = print::toBuffer(aLine, sizeof(aLine), "{} {} {} {} {}\n", res.size, res.mtime, res.lufs, res.peak, svPath);
+    fwrite(aLine, 1, n, pFile);
+}
+
+void
+Scanner::rewriteCache(const char* ntsCachePath)
+{
+    /* Next to it and renamed over, a crash leaves the old file. */
+    char aTmpPath[1024 + 8] {};
+    const isize n = print::toBuffer(aTmpPath, sizeof(aTmpPath) - 1, "{}.tmp", ntsCachePath);
+    aTmpPath[n] = '\0';
+
+    FILE* pFile = fopen(aTmpPath, "wb");
+    if (!pFile)
+    {
+        LogWarn{"failed to open '{}': {}\n", aTmpPath, strerror(errno)};
+        return;
+    }
+
+    for (auto& kv : m_mCached) writeLine(pFile, kv.key, kv.val);
+
+    if (fclose(pFile) != 0 || rename(aTmpPath, ntsCachePath) != 0)
+    {
+        LogWarn{"failed to rewrite '{}': {}\n", ntsCachePath, strerror(errno)};
+        remove(aTmpPath);
+    }
+}
+
+void
+Scanner::loadCache(StringView svCachePath)
+{
+    m_sCache = file::load(Gpa::inst(), svCachePath.data());
+    if (m_sCache.size() <= 0) return;
+
+    /* size mtime lufs peak path */
+    isize nOutdated = 0;
+    for (StringView svLine : StringWordIt {m_sCache, "\n"})
+    {
+        Result res {};
+        StringView svRest = svLine;
+        isize fieldI = 0;
+
+        for (; fieldI < 4; ++fieldI)
+        {
+            const isize spaceI = svRest.charAt(' ');
+            if (spaceI == NPOS) break;
+
+            const StringView svField = svRest.subString(0, spaceI);
+            switch (fieldI)
+            {
+                case 0: res.size = svField.toI64(); break;
+                case 1: res.mtime = svField.toI64(); break;
+                case 2: res.lufs = svField.toF64(); break;
+                case 3: res.peak = svField.toF64(); break;
+            }
+
+            svRest = svRest.subString(spaceI + 1);
+        }
+
+        if (fieldI != 4 || svRest.size() <= 0) continue;
+
+        /* Rescans of changed files append, the earlier lines for the path are outdated. */
+        if (auto found = m_mCached.search(svRest))
+        {
+            found.value() = res;
+            ++nOutdated;
+        }
+        else
+        {
+            m_mCached.insert(Gpa::inst(), svRest, res);
+        }
+    }
+
+    LogDebug{"loudness: {} cached entries, {} outdated lines\n", m_mCached.m_nOccupied, nOutdated};
+
+    if (nOutdated > 0) rewriteCache(svCachePath.data());
+}
+
+} /* namespace loudness */
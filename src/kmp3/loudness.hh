@@ -0,0 +1,93 @@
+#pragma once
+
+/* ReplayGain style normalization, EBU R128 / ITU-R BS.1770 loudness of whole songs.
+ * Scanner measures the playlist in the background and keeps results in a cache file next to other kmp3 caches. */
+
+namespace loudness
+{
+
+/* Integrated loudness (LUFS) and 4x oversampled true peak of interleaved f32.
+ * K-weighting and the peak interpolator run on all channels at once, one SIMD lane per channel. */
+struct Meter
+{
+    static constexpr int MAX_CHANNELS = 8; /* The rest is not measured. */
+    static constexpr isize N_PEAK_PHASES = 4;
+    static constexpr isize N_PEAK_TAPS = 12; /* Per phase. */
+    static constexpr f64 SILENCE_LUFS = -70.0; /* Absolute gate. */
+
+    /* Transposed direct form II biquads, high shelf then the RLB high-pass: b0, b1, b2, a1, a2. */
+    f32 m_aShelf[5] {};
+    f32 m_aHighPass[5] {};
+    alignas(32) f32 m_aaState[4][MAX_CHANNELS] {}; /* Shelf s1, s2, high-pass s1, s2. */
+    alignas(32) f32 m_aaHistory[N_PEAK_TAPS * 2][MAX_CHANNELS] {}; /* Mirrored, so the window is always contiguous. */
+    alignas(32) f32 m_aaPeakCoeffs[N_PEAK_PHASES][N_PEAK_TAPS] {}; /* Oldest sample first. */
+    alignas(32) f32 m_aEnergy[MAX_CHANNELS] {}; /* Of the current 100ms sub-block. */
+    alignas(32) f32 m_aPeak[MAX_CHANNELS] {};
+    f32 m_aWeights[MAX_CHANNELS] {};
+    f64 m_aSubBlocks[4] {}; /* Weighted energy of the last 4 sub-blocks, one gating block (400ms, 75% overlap). */
+    VecManaged<f32> m_vBlocks {}; /* Mean power of each gating block. */
+    isize m_subBlockFrames {};
+    isize m_subBlockPos {};
+    isize m_nSubBlocks {};
+    isize m_historyPos {};
+    int m_nChannels {};
+
+    /* */
+
+    Meter() = default;
+    Meter(int nChannels, u32 sampleRate);
+
+    /* */
+
+    void destroy() noexcept;
+    void process(Span<const f32> sp) noexcept; /* Whole frames only. */
+    [[nodiscard]] f64 integrated() const noexcept; /* SILENCE_LUFS if nothing passed the gates. */
+    [[nodiscard]] f32 truePeak() const noexcept; /* Linear. */
+
+protected:
+    void finishSubBlock() noexcept;
+};
+
+struct Result
+{
+    i64 size {}; /* File size and mtime invalidate the cached entry. */
+    i64 mtime {};
+    f32 lufs {};
+    f32 peak {};
+
+    /* */
+
+    [[nodiscard]] f32 gain(f64 targetLufs) const noexcept; /* Linear, limited by the peak so it doesn't clip. */
+};
+
+/* Measures the playlist on a ThreadPool (one decoder per worker), skipping songs whose cached entry is still valid. */
+struct Scanner
+{
+    Mutex m_mtx {};
+    Map<StringView, Result> m_mCached {}; /* Loaded from the cache file, keys point into m_sCache. */
+    Map<StringView, Result> m_mReady {}; /* Validated or measured, keys point into the playlist. */
+    String m_sCache {};
+    FILE* m_pCacheFile {}; /* New results get appended, the last entry for a path wins, loadCache() drops the outdated ones. */
+    Span<const StringView> m_spPaths {};
+    Thread m_thrd {};
+    atomic::Int m_atom_nextI {};
+    atomic::Int m_atom_nScanned {};
+    atomic::Bool m_atom_bQuit {false};
+    bool m_bStarted = false;
+
+    /* */
+
+    void start(Span<const StringView> spPaths); /* spPaths must outlive the Scanner. */
+    void destroy() noexcept; /* Stops the scan. */
+    [[nodiscard]] bool find(StringView svPath, Result* pRes);
+
+protected:
+    THREAD_STATUS loop();
+    void scanLoop();
+    void scan(StringView svPath);
+    void loadCache(StringView svCachePath);
+    void rewriteCache(const char* ntsCachePath); /* One line per path, from m_mCached. */
+    void writeLine(FILE* pFile, StringView svPath, const Result& res);
+};
+
+} /* namespace loudness */
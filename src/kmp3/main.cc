@@ -34,12 +34,11 @@ setTermEnv()
     else app::g_eTerm = app::TERM::ELSE;
 
 #ifdef OPT_CHAFA
-    ChafaTermInfo* pTermInfo {};
     ChafaPixelMode pixelMode;
     ChafaCanvasMode mode;
 
-    platform::chafa::detectTerminal(&pTermInfo, &mode, &pixelMode);
-    defer( chafa_term_info_unref(pTermInfo) );
+    platform::chafa::start();
+    platform::chafa::termModes(&mode, &pixelMode);
 
     if (pixelMode != CHAFA_PIXEL_MODE_SYMBOLS)
     {
@@ -80,6 +79,40 @@ parseArgs(int argc, char** argv)
                 return ArgvParser::RESULT::GOOD;
             },
         },
+        {
+            .bNeedsValue = false,
+            .sTwoDashes = "normalize",
+            .sUsage = "level songs to the same loudness (scanned in the background)",
+            .pfn = [](ArgvParser*, void*, const StringView, const StringView) {
+                app::g_config.bNormalizeLoudness = true;
+                return ArgvParser::RESULT::GOOD;
+            },
+        },
+        {
+            .bNeedsValue = true,
+            .sTwoDashes = "buffering",
+            .sUsage = "value: normal, low-latency or power-save",
+            .pfn = [](ArgvParser* pSelf, void*, const StringView, const StringView svVal) {
+                if (svVal == "normal") app::g_config.eBufferProfile = BUFFER_PROFILE::NORMAL;
+                else if (svVal == "low-latency") app::g_config.eBufferProfile = BUFFER_PROFILE::LOW_LATENCY;
+                else if (svVal == "power-save") app::g_config.eBufferProfile = BUFFER_PROFILE::POWER_SAVE;
+                else
+                {
+                    print::toFILE(pSelf->m_pFile, "unknown buffering profile: '{}'\n", svVal);
+                    return ArgvParser::RESULT::QUIT_BADLY;
+                }
+                return ArgvParser::RESULT::GOOD;
+            },
+        },
+        {
+            .bNeedsValue = false,
+            .sTwoDashes = "bit-perfect",
+            .sUsage = "keep integer sources in their own format and rate (alsa, pipewire)",
+            .pfn = [](ArgvParser*, void*, const StringView, const StringView) {
+                app::g_config.bBitPerfect = true;
+                return ArgvParser::RESULT::GOOD;
+            },
+        },
         {
             .bNeedsValue = false,
             .sTwoDashes = "no-image",
@@ -303,12 +336,48 @@ startup(int argc, char** argv)
     player.m_bSelectionChanged = true;
 
     setTermEnv();
+#ifdef OPT_CHAFA
+    defer( platform::chafa::destroy() );
+#endif
 
     if (!player.m_vSongs.empty())
     {
         app::decoder().init();
         defer( app::decoder().destroy() );
 
+        app::nextDecoder().init();
+        app::nextDecoder().m_bPreloads = true;
+        defer( app::nextDecoder().destroy() );
+
+        if (app::g_config.bSeekIndex)
+        {
+            app::seekIndexer().start();
+            app::decoder().m_pSeekIndexer = app::nextDecoder().m_pSeekIndexer = &app::seekIndexer();
+        }
+        defer( app::seekIndexer().destroy() );
+
+        if (app::g_config.bStreamInfoCache)
+        {
+            app::streamInfoCache().start(app::cacheDir());
+            app::decoder().m_pInfoCache = app::nextDecoder().m_pInfoCache = &app::streamInfoCache();
+        }
+        defer( app::streamInfoCache().destroy() );
+
+#ifdef OPT_CHAFA
+        if (!app::g_bNoImage)
+        {
+            app::coverLoader().start(app::g_config.bCoverCache ? app::cacheDir() : StringView {});
+            app::decoder().m_pCoverLoader = app::nextDecoder().m_pCoverLoader = &app::coverLoader();
+            app::imageCache().start(app::g_config.imageCacheSize);
+        }
+        defer( app::coverLoader().destroy() );
+        defer( app::imageCache().destroy() );
+#endif
+
+        if (app::g_config.bNormalizeLoudness)
+            app::loudnessScanner().start({player.m_vSongs.data(), player.m_vSongs.size()});
+        defer( app::loudnessScanner().destroy() );
+
         app::g_pMixer = &app::allocMixer(Gpa::inst())->start();
         app::mixer().setVolume(app::g_config.volume);
         defer( app::mixer().destroy() );
@@ -7,6 +7,20 @@ namespace platform::alsa
 {
 
 constexpr auto ntsDEVICE = "default";
+constexpr int POLL_TIMEOUT_MS = 1000; /* Device stopped consuming, reopen it. */
+
+static snd_pcm_format_t
+pcmFormat(audio::PCM_TYPE e)
+{
+    switch (e)
+    {
+        case audio::PCM_TYPE::S16: return SND_PCM_FORMAT_S16;
+        case audio::PCM_TYPE::S32: return SND_PCM_FORMAT_S32;
+        case audio::PCM_TYPE::F32: return SND_PCM_FORMAT_FLOAT;
+    }
+
+    return SND_PCM_FORMAT_FLOAT;
+}
 
 static void
 errorHandler(const char* pFile, int line, const char* pFunc, int, const char* pFmt, ...)
@@ -49,33 +63,36 @@ Mixer::setHwParams(snd_pcm_hw_params_t* params, snd_pcm_access_t access)
         return err;
     }
     /* set the sample format */
-    err = snd_pcm_hw_params_set_format(m_pHandle, params, SND_PCM_FORMAT_FLOAT);
+    err = snd_pcm_hw_params_set_format(m_pHandle, params, pcmFormat(m_eDevicePcmType));
     if (err < 0)
     {
         LogError("Sample format not available for playback: {}\n", snd_strerror(err));
         return err;
     }
     /* set the count of channels */
-    err = snd_pcm_hw_params_set_channels(m_pHandle, params, m_nChannels);
+    err = snd_pcm_hw_params_set_channels(m_pHandle, params, m_nDeviceChannels);
     if (err < 0)
     {
-        LogError("Channels count ({}) not available for playbacks: {}\n", m_nChannels, snd_strerror(err));
+        LogError("Channels count ({}) not available for playbacks: {}\n", m_nDeviceChannels, snd_strerror(err));
         return err;
     }
     /* set the stream rate */
-    rrate = m_sampleRate;
+    rrate = m_deviceConfiguredRate;
     err = snd_pcm_hw_params_set_rate_near(m_pHandle, params, &rrate, 0);
     if (err < 0)
     {
-        LogError("Rate {}Hz not available for playback: {}\n", m_sampleRate, snd_strerror(err));
+        LogError("Rate {}Hz not available for playback: {}\n", m_deviceConfiguredRate, snd_strerror(err));
         return err;
     }
-    if (rrate != m_sampleRate)
+    if (rrate != m_deviceConfiguredRate)
     {
-        LogError("Rate doesn't match (requested {}Hz, get {}Hz)\n", m_sampleRate, err);
+        LogError("Rate doesn't match (requested {}Hz, get {}Hz)\n", m_deviceConfiguredRate, err);
         return -EINVAL;
     }
-    /* set the buffer time */
+    /* set the buffer time, the ring has to hold more than a period (audio::BufferProfile) */
+    const audio::BufferProfile& profile = audio::BUFFER_PROFILES[int(app::g_config.eBufferProfile)];
+    m_bufferTime = unsigned(profile.deviceBufferMs * 1000.0);
+    m_periodTime = unsigned(profile.devicePeriodMs * 1000.0);
     err = snd_pcm_hw_params_set_buffer_time_near(m_pHandle, params, &m_bufferTime, &dir);
     if (err < 0)
     {
@@ -103,7 +120,7 @@ Mixer::setHwParams(snd_pcm_hw_params_t* params, snd_pcm_access_t access)
         return err;
     }
     m_periodSize = size;
-    LogDebug{"pediodSize: {}\n", m_periodSize};
+    LogDebug{"pediodSize: {} ({} us), bufferSize: {} ({} us)\n", m_periodSize, m_periodTime, m_bufferSize, m_bufferTime};
     /* write the parameters to device */
     err = snd_pcm_hw_params(m_pHandle, params);
     if (err < 0)
@@ -205,16 +222,12 @@ Mixer::deinit()
 bool
 Mixer::play(StringView svPath)
 {
-    const f64 prevSpeed = f64(m_changedSampleRate) / f64(m_sampleRate);
-
     pause(true);
 
     if (!playFinal(svPath)) return false;
 
-    setConfig(app::decoder().getSampleRate(), app::decoder().getChannelsCount(), true);
-
-    if (!utils::floatEq(prevSpeed, 1.0))
-        changeSampleRate(f64(m_sampleRate) * prevSpeed, false);
+    /* Rate is handled by the resampler, only bit-perfect songs change it and the format. */
+    if (needsDeviceConfig()) configureDevice();
 
     pause(false);
 
@@ -244,55 +257,34 @@ Mixer::pause(bool bPause)
 }
 
 void
-Mixer::changeSampleRate(u64 sampleRate, bool bSave)
+Mixer::configureDevice()
 {
+    LockScope lock {&m_mtxLoop};
     int err = 0;
 
-    pause(true);
-
-    err = snd_pcm_set_params(
-        m_pHandle,
-        SND_PCM_FORMAT_FLOAT,
-        SND_PCM_ACCESS_RW_INTERLEAVED,
-        m_nChannels, sampleRate, 1, 50000
-    );
-
-    pause(false);
+    m_nDeviceChannels = m_nChannels;
+    m_deviceConfiguredRate = m_deviceSampleRate;
+    m_eDevicePcmType = m_ePcmType;
 
-    if (err < 0)
-    {
-        LogError{"{}\n", snd_strerror(err)};
-        return;
-    }
-
-    if (bSave) m_sampleRate = sampleRate;
-    m_changedSampleRate = sampleRate;
-}
+    /* Back to SETUP, whatever is queued belongs to the previous song. */
+    snd_pcm_drop(m_pHandle);
 
-void
-Mixer::setConfig(u64 sampleRate, int nChannels, bool bSaveNewConfig)
-{
-    LockScope lock {&m_mtxLoop};
-    int err = 0;
+    /* Same buffer, period and thresholds as openAlsa(). */
+    auto set = [&](snd_pcm_access_t eAccess) {
+        const int errHw = setHwParams(m_pHwParams, eAccess);
+        return errHw < 0 ? errHw : setSwParams(m_pSwParams);
+    };
 
-    if (bSaveNewConfig)
+    if (m_bMmap && (err = set(SND_PCM_ACCESS_MMAP_INTERLEAVED)) < 0)
     {
-        m_changedSampleRate = m_sampleRate = sampleRate;
-        m_nChannels = nChannels;
+        LogInfo{"mmap access failed ({}), falling back to writei\n", snd_strerror(err)};
+        m_bMmap = false;
     }
 
-    sampleRate = utils::clamp(sampleRate, app::g_config.minSampleRate, app::g_config.maxSampleRate);
-    nChannels = utils::clamp(nChannels, 1, 20);
+    if (!m_bMmap)
+        ADT_RUNTIME_EXCEPTION_FMT((err = set(SND_PCM_ACCESS_RW_INTERLEAVED)) >= 0, "({}): {}", err, snd_strerror(err));
 
-    ADT_RUNTIME_EXCEPTION_FMT(
-        (err = snd_pcm_set_params(
-            m_pHandle,
-            SND_PCM_FORMAT_FLOAT,
-            SND_PCM_ACCESS_RW_INTERLEAVED,
-            nChannels, sampleRate, 1, 50000
-        )) >= 0,
-        "({}): {}", err, snd_strerror(err)
-    );
+    updatePollFds();
 }
 
 void
@@ -301,7 +293,7 @@ Mixer::openAlsa()
     int err = 0;
 
     ADT_RUNTIME_EXCEPTION_FMT(
-        (err = snd_pcm_open(&m_pHandle, ntsDEVICE, SND_PCM_STREAM_PLAYBACK, 0)) >= 0,
+        (err = snd_pcm_open(&m_pHandle, ntsDEVICE, SND_PCM_STREAM_PLAYBACK, SND_PCM_NONBLOCK)) >= 0,
         "({}): {}", err, snd_strerror(err)
     );
 
@@ -310,8 +302,85 @@ Mixer::openAlsa()
 
     snd_lib_error_set_handler(errorHandler);
 
-    ADT_RUNTIME_EXCEPTION_FMT((err = setHwParams(m_pHwParams, SND_PCM_ACCESS_RW_INTERLEAVED)) >= 0, "{}", snd_strerror(err));
+    m_bMmap = (err = setHwParams(m_pHwParams, SND_PCM_ACCESS_MMAP_INTERLEAVED)) >= 0;
+    if (!m_bMmap)
+    {
+        LogInfo{"mmap access failed ({}), falling back to writei\n", snd_strerror(err)};
+        ADT_RUNTIME_EXCEPTION_FMT((err = setHwParams(m_pHwParams, SND_PCM_ACCESS_RW_INTERLEAVED)) >= 0, "{}", snd_strerror(err));
+    }
     ADT_RUNTIME_EXCEPTION_FMT((err = setSwParams(m_pSwParams)) >= 0, "{}", snd_strerror(err));
+
+    updatePollFds();
+}
+
+void
+Mixer::updatePollFds()
+{
+    const int n = snd_pcm_poll_descriptors_count(m_pHandle);
+    ADT_RUNTIME_EXCEPTION_FMT(n > 0 && n <= int(utils::size(m_aPollFds)), "poll descriptors count: {}", n);
+
+    m_nPollFds = snd_pcm_poll_descriptors(m_pHandle, m_aPollFds, n);
+}
+
+void
+Mixer::recover(int err)
+{
+    const i64 t0 = time::nowUS();
+    const int nXruns = m_atom_nXruns.fetchAdd(1, atomic::ORDER::RELAXED) + 1;
+
+    /* Underrun (-EPIPE) or suspend (-ESTRPIPE) just need a prepare, reopening the whole device is the last resort. */
+    if (const int errRecover = snd_pcm_recover(m_pHandle, err, 1); errRecover < 0)
+    {
+        LogWarn{"snd_pcm_recover(): {}\n", snd_strerror(errRecover)};
+        xrunRecovery();
+    }
+
+    const i64 t1 = time::nowUS();
+    m_xrunRecoveryUS += t1 - t0;
+
+    LogWarn{"xrun #{} ({}): {} ms after the previous one, recovered in {} us (total {} us)\n",
+        nXruns, snd_strerror(err), m_lastXrunUS > 0 ? (t0 - m_lastXrunUS) / 1000 : 0, t1 - t0, m_xrunRecoveryUS
+    };
+
+    m_lastXrunUS = t0;
+}
+
+int
+Mixer::waitWritable()
+{
+    while (true)
+    {
+        const snd_pcm_sframes_t avail = snd_pcm_avail_update(m_pHandle);
+        if (avail < 0) return int(avail);
+        if (avail >= m_periodSize) return 0;
+
+        /* Full but below the start threshold (short buffer after a seek), poll() would wait forever. */
+        if (snd_pcm_state(m_pHandle) == SND_PCM_STATE_PREPARED)
+        {
+            if (const int err = snd_pcm_start(m_pHandle); err < 0) return err;
+        }
+
+        const int nReady = poll(m_aPollFds, m_nPollFds, POLL_TIMEOUT_MS);
+        if (nReady < 0)
+        {
+            if (errno == EINTR) continue;
+            return -errno;
+        }
+        if (nReady == 0) return -EIO;
+
+        unsigned short revents = 0;
+        snd_pcm_poll_descriptors_revents(m_pHandle, m_aPollFds, m_nPollFds, &revents);
+
+        if (revents & POLLERR)
+        {
+            switch (snd_pcm_state(m_pHandle))
+            {
+                case SND_PCM_STATE_XRUN: return -EPIPE;
+                case SND_PCM_STATE_SUSPENDED: return -ESTRPIPE;
+                default: return -EIO;
+            }
+        }
+    }
 }
 
 void
@@ -326,6 +395,73 @@ Mixer::xrunRecovery()
     openAlsa();
 }
 
+int
+Mixer::writePeriodMmap()
+{
+    const isize frameSize = m_nDeviceChannels * audio::pcmTypeSize(m_eDevicePcmType);
+    snd_pcm_uframes_t nLeft = m_periodSize;
+
+    while (nLeft > 0)
+    {
+        const snd_pcm_channel_area_t* pAreas {};
+        snd_pcm_uframes_t offset = 0;
+        snd_pcm_uframes_t nFrames = nLeft;
+
+        if (const int err = snd_pcm_mmap_begin(m_pHandle, &pAreas, &offset, &nFrames); err < 0) return err;
+
+        /* Interleaved, all channels share the first area. */
+        u8* pDst = static_cast<u8*>(pAreas[0].addr) + pAreas[0].first/8 + offset*frameSize;
+        m_ringBuff.popRaw(pDst, nFrames * m_nDeviceChannels);
+
+        const snd_pcm_sframes_t nCommitted = snd_pcm_mmap_commit(m_pHandle, offset, nFrames);
+        if (nCommitted < 0) return int(nCommitted);
+        if (snd_pcm_uframes_t(nCommitted) != nFrames) return -EPIPE;
+
+        nLeft -= nFrames;
+    }
+
+    return 0;
+}
+
+int
+Mixer::writePeriodRw()
+{
+    const isize frameSize = m_nDeviceChannels * audio::pcmTypeSize(m_eDevicePcmType);
+    /* Periods of the bigger profiles at high rates or with many channels don't fit the drain buffer whole. */
+    const isize maxChunkFrames = utils::size(audio::g_aDrainBuffer) / m_nDeviceChannels;
+    isize nLeft = m_periodSize;
+
+    while (nLeft > 0)
+    {
+        const isize nChunk = utils::min(nLeft, maxChunkFrames);
+        ADT_ASSERT(nChunk * m_nDeviceChannels <= utils::size(audio::g_aDrainBuffer),
+            "nChunk: {}, nDeviceChannels: {}", nChunk, m_nDeviceChannels
+        );
+        m_ringBuff.popRaw(audio::g_aDrainBuffer, nChunk * m_nDeviceChannels);
+
+        u8* ptr = reinterpret_cast<u8*>(audio::g_aDrainBuffer);
+        isize cptr = nChunk;
+        while (cptr > 0)
+        {
+            snd_pcm_sframes_t err = snd_pcm_writei(m_pHandle, ptr, cptr);
+            if (err == -EAGAIN)
+            {
+                if (const int errWait = waitWritable(); errWait < 0) return errWait;
+                continue;
+            }
+
+            if (err < 0) return int(err);
+
+            ptr += err * frameSize;
+            cptr -= err;
+        }
+
+        nLeft -= nChunk;
+    }
+
+    return 0;
+}
+
 THREAD_STATUS
 Mixer::loop()
 {
@@ -334,19 +470,9 @@ Mixer::loop()
     snd_pcm_start(m_pHandle);
 
     bool bPaused = true;
-    bool bReinit = false;
 
     while (m_atom_bRunning.load(atomic::ORDER::ACQUIRE))
     {
-        isize nSamplesRequested = 0;
-        const f32 vol = m_bMuted ? 0.0f : std::pow(m_volume * (1.0f/100.0f), 3.0f);
-
-        nSamplesRequested = m_periodSize * m_nChannels;
-        m_ringBuff.pop({audio::g_aDrainBuffer, nSamplesRequested});
-
-        for (isize sampleI = 0; sampleI < nSamplesRequested; ++sampleI)
-            audio::g_aDrainBuffer[sampleI] *= vol;
-
         {
             LockScope lock {&m_mtxLoop};
 
@@ -363,32 +489,13 @@ Mixer::loop()
             if (bPaused)
             {
                 bPaused = false;
-                bReinit = false;
                 snd_pcm_prepare(m_pHandle);
             }
 
-            if (bReinit)
-            {
-                bReinit = false;
-                xrunRecovery();
-            }
-
-            f32* ptr = audio::g_aDrainBuffer;
-            isize cptr = m_periodSize;
-            while (cptr > 0)
-            {
-                snd_pcm_sframes_t err = snd_pcm_writei(m_pHandle, ptr, cptr);
-                if (err == -EAGAIN) continue;
-
-                if (err < 0)
-                {
-                    bReinit = true;
-                    break;
-                }
-
-                ptr += err * m_nChannels;
-                cptr -= err;
-            }
+            /* Not before the pause, configureDevice() can change the format while paused. */
+            int err = waitWritable();
+            if (err >= 0) err = m_bMmap ? writePeriodMmap() : writePeriodRw();
+            if (err < 0) recover(err);
         }
     }
 
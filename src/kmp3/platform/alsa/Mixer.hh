@@ -3,6 +3,7 @@
 #include "audio.hh"
 
 #include <alsa/asoundlib.h>
+#include <poll.h>
 
 namespace platform::alsa
 {
@@ -17,11 +18,19 @@ struct Mixer : public audio::IMixer
     Mutex m_mtxLoop {INIT};
     CndVar m_cndLoop {INIT};
 
-    unsigned int m_bufferTime = 500000; /* ring buffer length in us */
-    unsigned int m_periodTime = 100000; /* period time in us */
+    unsigned int m_bufferTime {}; /* ring buffer length in us, asked from audio::BufferProfile, what the device gave */
+    unsigned int m_periodTime {}; /* period time in us */
 
     snd_pcm_sframes_t m_bufferSize;
     snd_pcm_sframes_t m_periodSize;
+    bool m_bMmap = false; /* SND_PCM_ACCESS_MMAP_INTERLEAVED, RW_INTERLEAVED if the device can't. */
+
+    pollfd m_aPollFds[8] {}; /* PCM is non-blocking, loop() sleeps in poll() on these. */
+    int m_nPollFds {};
+
+    /* Loop thread only, m_atom_nXruns counts them. */
+    i64 m_lastXrunUS {};
+    i64 m_xrunRecoveryUS {}; /* Total time spent in recover(). */
 
     snd_pcm_hw_params_t *m_pHwParams;
     snd_pcm_sw_params_t *m_pSwParams;
@@ -32,9 +41,9 @@ struct Mixer : public audio::IMixer
     virtual void deinit() override;
     virtual bool play(StringView svPath) override;
     virtual void pause(bool bPause) override;
-    virtual void changeSampleRate(u64 sampleRate, bool bSave) override;
+    [[nodiscard]] virtual bool supportsPcmType(audio::PCM_TYPE) const override { return true; }
 
-    void setConfig(u64 sampleRate, int nChannels, bool bSaveNewConfig);
+    void configureDevice(); /* To the current song's channels, rate and format. */
     THREAD_STATUS loop();
 
 protected:
@@ -42,7 +51,13 @@ protected:
     int setSwParams(snd_pcm_sw_params_t* swparams);
 
     void openAlsa();
-    void xrunRecovery();
+    void xrunRecovery(); /* Reopens the device, when snd_pcm_recover() can't help. */
+    void updatePollFds();
+    void recover(int err);
+    /* These return 0 or negative alsa error for recover(). */
+    [[nodiscard]] int waitWritable(); /* Until a period fits. */
+    [[nodiscard]] int writePeriodMmap(); /* Pops straight into the device buffer. */
+    [[nodiscard]] int writePeriodRw(); /* Through g_aDrainBuffer, in chunks of at most its size, a period can be bigger. */
 };
 
 } /* namespace platform::alsa */
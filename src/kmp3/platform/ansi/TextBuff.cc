@@ -186,6 +186,12 @@ TextBuff::clearKittyImages()
     push("\x1b_Ga=d,d=A\x1b\\");
 }
 
+void
+TextBuff::clearKittyPlacements()
+{
+    push("\x1b_Ga=d,d=a,q=2\x1b\\");
+}
+
 void
 TextBuff::setTitle(const StringView svTitle)
 {
@@ -150,6 +150,7 @@ struct TextBuff
     void hideCursor(bool bHide);
     void pushWChar(wchar_t wc);
     void clearKittyImages();
+    void clearKittyPlacements(); /* Terminal keeps the image data. */
     void setTitle(const StringView svTitle);
     /* */
 
@@ -11,11 +11,18 @@ namespace platform::ansi
 int
 Win::calcImageHeightSplit()
 {
-    const Image img = app::decoder().getCoverImage();
+#ifdef OPT_CHAFA
+    const Player& pl = app::player();
 
-    if (img.height > 0 && img.width > 0)
-        return app::player().m_imgHeight + 1;
-    else return 12; /* Default offset from the top to the start of the list. */
+    if (pl.m_selectedI >= 0 && pl.m_selectedI < pl.m_vSongs.size() &&
+        app::coverLoader().hasCover(pl.m_vSongs[pl.m_selectedI])
+    )
+    {
+        return pl.m_imgHeight + 1;
+    }
+#endif
+
+    return 12; /* Default offset from the top to the start of the list. */
 }
 
 void
@@ -60,6 +67,9 @@ Win::start(Arena* pArena)
 
     enableRawMode();
     m_textBuff.start(m_pArena, m_termSize.width, m_termSize.height);
+#ifdef OPT_CHAFA
+    if (!app::g_bNoImage) m_kitty.start();
+#endif
 
     adjustListHeight();
 
@@ -7,6 +7,10 @@
 
 #include <termios.h>
 
+#ifdef OPT_CHAFA
+    #include "platform/chafa/Kitty.hh"
+#endif
+
 namespace platform::ansi
 {
 
@@ -57,6 +61,10 @@ protected:
     int m_lastMouseSelection {};
     time::Type m_lastMouseSelectionTime {};
     time::Type m_lastImageRedrawTime {};
+#ifdef OPT_CHAFA
+    int m_lastCoverPublished {}; /* CoverLoader::m_atom_nPublished at the last check. */
+    platform::chafa::Kitty m_kitty {};
+#endif
     time::Type m_lastResizeTime {};
     bool m_bNeedsResize {};
     bool m_bImageJustRedrawn {};
@@ -11,6 +11,14 @@ Win::coverImage()
 {
     auto& pl = app::player();
 
+    /* Cover gets decoded in the background, draw it once it's there. */
+    const int nPublished = app::coverLoader().m_atom_nPublished.load(atomic::ORDER::ACQUIRE);
+    if (nPublished != m_lastCoverPublished)
+    {
+        m_lastCoverPublished = nPublished;
+        pl.m_bRedrawImage = true;
+    }
+
     const i64 time = utils::max(m_lastResizeTime, m_time);
     if (pl.m_bSelectionChanged || (pl.m_bRedrawImage && (time::diff(time, m_lastImageRedrawTime) >= time::MSEC * app::g_config.imageUpdateRateLimit))
         /* Prevent to redraw too often if window is getting resized too aggressively. */
@@ -22,19 +30,35 @@ Win::coverImage()
 
         const int split = pl.m_imgHeight;
 
-        if (!app::g_bChafaSymbols) m_textBuff.clearKittyImages();
+        if (m_kitty.m_bEnabled) m_textBuff.clearKittyPlacements();
+        else if (!app::g_bChafaSymbols) m_textBuff.clearKittyImages();
         m_textBuff.forceClean(1, 1, m_prevImgWidth + 1, split + 1);
 
-        Image img = app::decoder().getCoverImage();
-
         namespace c = platform::chafa;
 
+        int targetWidth {}, targetHeight {};
+        c::targetPixelSize(split, m_termSize.width, &targetWidth, &targetHeight);
+        app::coverLoader().setTargetSize(targetWidth, targetHeight);
+
+        const StringView svPath = pl.m_selectedI >= 0 && pl.m_selectedI < pl.m_vSongs.size() ? pl.m_vSongs[pl.m_selectedI] : StringView {};
+
         c::IMAGE_LAYOUT eLayout = app::g_bSixelOrKitty ? c::IMAGE_LAYOUT::RAW : c::IMAGE_LAYOUT::LINES;
 
+        auto& cache = app::imageCache();
+        c::Image chafaImg {};
+
         /* NOTE: using textBuff's dedicated image arena */
-        auto chafaImg = c::allocImage(
-            &m_textBuff.m_imgArena, eLayout, img, split, m_termSize.width
-        );
+        if (m_kitty.m_bEnabled)
+        {
+            chafaImg = m_kitty.place(&m_textBuff.m_imgArena, svPath, split, m_termSize.width);
+        }
+        else
+        {
+            chafaImg = cache.render(&m_textBuff.m_imgArena, cache.makeKey(svPath, eLayout, split, m_termSize.width));
+
+            /* Ready by the time the next song starts. */
+            cache.prerender(cache.makeKey(pl.m_svNextSong, eLayout, split, m_termSize.width));
+        }
 
         m_textBuff.image(1, 1, chafaImg);
 
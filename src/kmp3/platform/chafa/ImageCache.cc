@@ -0,0 +1,197 @@
+#include "ImageCache.hh"
+
+#include "app.hh"
+
+namespace platform::chafa
+{
+
+void
+ImageCache::start(isize maxBytes)
+{
+    new(&m_mtx) Mutex {Mutex::TYPE::PLAIN};
+    new(&m_cnd) CndVar {INIT};
+    m_maxBytes = maxBytes;
+
+    termModes(&m_eCanvasMode, &m_ePixelMode);
+
+    m_bStarted = true;
+    new(&m_thrd) Thread {
+        [](void* p) { return static_cast<ImageCache*>(p)->loop(); },
+        this
+    };
+}
+
+void
+ImageCache::destroy() noexcept
+{
+    if (!m_bStarted) return;
+
+    {
+        LockScope lock {&m_mtx};
+        m_atom_bQuit.store(true, atomic::ORDER::RELEASE);
+        m_cnd.signal();
+    }
+    m_thrd.join();
+
+    for (Entry& e : m_vEntries) freeImage(Gpa::inst(), &e.img);
+    m_vEntries.destroy();
+    m_nBytes = 0;
+    m_mtx.destroy();
+    m_cnd.destroy();
+    m_bStarted = false;
+}
+
+ImageCache::Entry*
+ImageCache::search(const ImageKey& key)
+{
+    for (Entry& e : m_vEntries)
+        if (e.key == key) return &e;
+
+    return nullptr;
+}
+
+ImageKey
+ImageCache::makeKey(StringView svPath, IMAGE_LAYOUT eLayout, int termHeight, int termWidth)
+{
+    ImageKey key {
+        .termHeight = termHeight,
+        .termWidth = termWidth,
+        .eLayout = eLayout,
+        .eCanvasMode = m_eCanvasMode,
+        .ePixelMode = m_ePixelMode,
+    };
+
+    if (svPath.size() > 0 && app::coverLoader().coverSize(svPath, &key.srcWidth, &key.srcHeight))
+        key.svPath = svPath;
+
+    cellPixelSize(&key.cellWidth, &key.cellHeight);
+
+    return key;
+}
+
+Image
+ImageCache::render(IAllocator* pAlloc, const ImageKey& key)
+{
+    if (key.svPath.size() == 0) return {};
+
+    if (m_bStarted)
+    {
+        LockScope lock {&m_mtx};
+
+        if (Entry* pEntry = search(key))
+        {
+            pEntry->lastUse = ++m_useCounter;
+            return copyImage(pAlloc, pEntry->img);
+        }
+    }
+
+    ImageKey newKey {};
+    Image img {};
+    if (!renderNew(key, &newKey, &img)) return {};
+
+    /* Cached one can get evicted before TextBuff shows it. */
+    Image ret = copyImage(pAlloc, img);
+    add(newKey, &img);
+
+    return ret;
+}
+
+void
+ImageCache::prerender(const ImageKey& key)
+{
+    if (!m_bStarted || key.svPath.size() == 0) return;
+
+    LockScope lock {&m_mtx};
+
+    if (search(key)) return;
+
+    m_pending = key;
+    m_cnd.signal();
+}
+
+bool
+ImageCache::renderNew(const ImageKey& key, ImageKey* pKey, Image* pImg)
+{
+    const ::Image cover = app::coverLoader().copyCover(Gpa::inst(), key.svPath);
+    if (cover.width <= 0 || cover.height <= 0) return false;
+    defer( Gpa::inst()->free(cover.pBuff) );
+
+    const time::Type t0 = time::nowUS();
+    *pImg = allocImage(Gpa::inst(), key.eLayout, cover, key.termHeight, key.termWidth);
+    if (pImg->width <= 0 || pImg->height <= 0) return false;
+
+    LogDebug{"image cache: rendered '{}' ({}x{} cells) in {} ms\n",
+        key.svPath, pImg->width, pImg->height, (time::nowUS() - t0) / 1000
+    };
+
+    /* Cover could've been rescaled since the key was made. */
+    *pKey = key;
+    pKey->srcWidth = cover.width;
+    pKey->srcHeight = cover.height;
+
+    return true;
+}
+
+void
+ImageCache::add(const ImageKey& key, Image* pImg)
+{
+    const isize nBytes = imageBytes(*pImg);
+
+    if (!m_bStarted || nBytes > m_maxBytes)
+    {
+        freeImage(Gpa::inst(), pImg);
+        return;
+    }
+
+    LockScope lock {&m_mtx};
+
+    if (search(key))
+    {
+        /* Rendered on both threads at once. */
+        freeImage(Gpa::inst(), pImg);
+        return;
+    }
+
+    while (m_vEntries.size() > 0 && m_nBytes + nBytes > m_maxBytes)
+    {
+        isize lruI = 0;
+        for (isize i = 1; i < m_vEntries.size(); ++i)
+            if (m_vEntries[i].lastUse < m_vEntries[lruI].lastUse) lruI = i;
+
+        Entry& lru = m_vEntries[lruI];
+        m_nBytes -= lru.nBytes;
+        freeImage(Gpa::inst(), &lru.img);
+        m_vEntries.popAsLast(lruI);
+    }
+
+    m_vEntries.push({.key = key, .img = *pImg, .nBytes = nBytes, .lastUse = ++m_useCounter});
+    m_nBytes += nBytes;
+    *pImg = {};
+}
+
+THREAD_STATUS
+ImageCache::loop()
+{
+    while (true)
+    {
+        ImageKey key {};
+        {
+            LockScope lock {&m_mtx};
+            while (!m_atom_bQuit.load(atomic::ORDER::ACQUIRE) && m_pending.svPath.size() == 0)
+                m_cnd.wait(&m_mtx);
+
+            if (m_atom_bQuit.load(atomic::ORDER::ACQUIRE)) break;
+
+            key = m_pending;
+            m_pending = {};
+        }
+
+        ImageKey newKey {};
+        Image img {};
+        if (renderNew(key, &newKey, &img)) add(newKey, &img);
+    }
+
+    return THREAD_STATUS(0);
+}
+
+} /* namespace platform::chafa */
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "chafa.hh"
+
+namespace platform::chafa
+{
+
+/* Same picture drawn into the same cells, font and terminal modes renders to the same output. */
+struct ImageKey
+{
+    StringView svPath {}; /* Empty if the cover isn't ready. */
+    int srcWidth {}; /* Of the scaled cover it's made from. */
+    int srcHeight {};
+    int termHeight {}; /* Cells it's fitted into. */
+    int termWidth {};
+    int cellWidth {}; /* Pixels, -1 if unknown. */
+    int cellHeight {};
+    IMAGE_LAYOUT eLayout {};
+    ChafaCanvasMode eCanvasMode {};
+    ChafaPixelMode ePixelMode {};
+
+    /* */
+
+    bool operator==(const ImageKey&) const = default;
+};
+
+/* LRU of allocImage() results bounded by bytes, going back to a song or to a previous size doesn't run chafa again.
+ * Renders the next song's cover on its own thread, the latest request is done first. Paths must outlive the cache. */
+struct ImageCache
+{
+    struct Entry
+    {
+        ImageKey key {};
+        Image img {}; /* Gpa. */
+        isize nBytes {};
+        i64 lastUse {};
+    };
+
+    Mutex m_mtx {};
+    CndVar m_cnd {};
+    Thread m_thrd {};
+    VecManaged<Entry> m_vEntries {};
+    isize m_nBytes {};
+    isize m_maxBytes {};
+    i64 m_useCounter {};
+    ImageKey m_pending {};
+    ChafaCanvasMode m_eCanvasMode {}; /* From termModes(). */
+    ChafaPixelMode m_ePixelMode {};
+    atomic::Bool m_atom_bQuit {false};
+    bool m_bStarted = false;
+
+    /* */
+
+    void start(isize maxBytes);
+    void destroy() noexcept;
+    [[nodiscard]] ImageKey makeKey(StringView svPath, IMAGE_LAYOUT eLayout, int termHeight, int termWidth);
+    [[nodiscard]] Image render(IAllocator* pAlloc, const ImageKey& key); /* Copy of the cached one, rendered and cached on a miss. */
+    void prerender(const ImageKey& key); /* Does nothing if it's cached. */
+
+protected:
+    THREAD_STATUS loop();
+    [[nodiscard]] Entry* search(const ImageKey& key); /* m_mtx must be locked. */
+    [[nodiscard]] bool renderNew(const ImageKey& key, ImageKey* pKey, Image* pImg); /* pKey gets the size of the cover it got. */
+    void add(const ImageKey& key, Image* pImg); /* Takes the Gpa image. */
+};
+
+} /* namespace platform::chafa */
@@ -0,0 +1,174 @@
+#include "Kitty.hh"
+
+#include "app.hh"
+
+#include <unistd.h>
+
+namespace platform::chafa
+{
+
+static void
+pushBase64(print::Builder* pPb, Span<const u8> sp)
+{
+    static constexpr char s_aTable[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    isize i = 0;
+    for (; i + 3 <= sp.size(); i += 3)
+    {
+        const u32 v = (u32(sp[i]) << 16) | (u32(sp[i + 1]) << 8) | u32(sp[i + 2]);
+        pPb->push(s_aTable[(v >> 18) & 63]);
+        pPb->push(s_aTable[(v >> 12) & 63]);
+        pPb->push(s_aTable[(v >> 6) & 63]);
+        pPb->push(s_aTable[v & 63]);
+    }
+
+    if (i < sp.size())
+    {
+        const bool bTwo = i + 1 < sp.size();
+        const u32 v = (u32(sp[i]) << 16) | (bTwo ? u32(sp[i + 1]) << 8 : 0);
+        pPb->push(s_aTable[(v >> 18) & 63]);
+        pPb->push(s_aTable[(v >> 12) & 63]);
+        pPb->push(bTwo ? s_aTable[(v >> 6) & 63] : '=');
+        pPb->push('=');
+    }
+}
+
+void
+Kitty::start()
+{
+    ChafaCanvasMode eMode {};
+    ChafaPixelMode ePixelMode {};
+    termModes(&eMode, &ePixelMode);
+    m_bEnabled = ePixelMode == CHAFA_PIXEL_MODE_KITTY;
+
+    /* The terminal has to see our /tmp, and not every kitty protocol implementation reads files. */
+    const bool bSsh = ::getenv("SSH_CONNECTION") || ::getenv("SSH_TTY");
+    m_bTempFile = m_bEnabled && !bSsh && (app::g_eTerm == app::TERM::KITTY || app::g_eTerm == app::TERM::GHOSTTY);
+
+    LogDebug{"kitty: enabled: {}, temp file: {}\n", m_bEnabled, m_bTempFile};
+}
+
+Kitty::Uploaded*
+Kitty::search(StringView svPath)
+{
+    for (Uploaded& e : m_aUploaded)
+        if (e.id != 0 && e.svPath == svPath) return &e;
+
+    return nullptr;
+}
+
+Image
+Kitty::place(IAllocator* pAlloc, StringView svPath, int termHeight, int termWidth)
+{
+    int srcWidth {}, srcHeight {};
+    if (!m_bEnabled || svPath.size() == 0 || !app::coverLoader().coverSize(svPath, &srcWidth, &srcHeight))
+        return {};
+
+    print::Builder pb {Gpa::inst(), 256};
+    defer( pb.destroy() );
+
+    Uploaded* pUploaded = search(svPath);
+
+    /* Rescaled covers go again under the same id, the terminal replaces the data. */
+    if (!pUploaded || pUploaded->width != srcWidth || pUploaded->height != srcHeight)
+    {
+        const ::Image cover = app::coverLoader().copyCover(Gpa::inst(), svPath);
+        if (cover.width <= 0 || cover.height <= 0) return {};
+        defer( Gpa::inst()->free(cover.pBuff) );
+
+        if (!pUploaded)
+        {
+            pUploaded = &m_aUploaded[m_nextUploadedI];
+            if (pUploaded->id != 0) pb.pushFmt("\x1b_Ga=d,d=I,i={},q=2\x1b\\", pUploaded->id);
+            m_nextUploadedI = (m_nextUploadedI + 1) % MAX_UPLOADED;
+
+            u32 id = u32(hash::func(svPath));
+            if (id == 0) id = 1; /* 0 is no id. */
+            *pUploaded = {.svPath = svPath, .id = id};
+        }
+
+        if (!m_bTempFile || !transmitFile(&pb, pUploaded->id, cover))
+            transmit(&pb, pUploaded->id, cover);
+
+        pUploaded->width = cover.width;
+        pUploaded->height = cover.height;
+
+        LogDebug{"kitty: transmitted '{}' ({}x{}), id: {}\n", svPath, cover.width, cover.height, pUploaded->id};
+    }
+
+    int widthCells {}, heightCells {};
+    fitCells(pUploaded->width, pUploaded->height, termHeight, termWidth, &widthCells, &heightCells);
+
+    /* Same placement id replaces the previous one, C=1 leaves the cursor alone. */
+    pb.pushFmt("\x1b_Ga=p,i={},p=1,c={},r={},C=1,q=2\x1b\\", pUploaded->id, widthCells, heightCells);
+
+    return {
+        .eLayout = IMAGE_LAYOUT::RAW,
+        .uData {.sRaw = String(pAlloc, StringView(pb))},
+        .width = widthCells,
+        .height = heightCells,
+    };
+}
+
+void
+Kitty::transmit(print::Builder* pPb, u32 id, const ::Image& cover)
+{
+    const Span<const u8> sp {cover.pBuff, isize(cover.width) * cover.height * 3};
+    constexpr isize RAW_CHUNK = CHUNK_SIZE / 4 * 3;
+
+    for (isize off = 0; off < sp.size(); off += RAW_CHUNK)
+    {
+        const isize n = utils::min(RAW_CHUNK, sp.size() - off);
+        const int more = off + n < sp.size() ? 1 : 0;
+
+        if (off == 0) pPb->pushFmt("\x1b_Ga=t,i={},f=24,s={},v={},q=2,m={};", id, cover.width, cover.height, more);
+        else pPb->pushFmt("\x1b_Gm={};", more);
+
+        pushBase64(pPb, {sp.data() + off, n});
+        pPb->push("\x1b\\");
+    }
+}
+
+bool
+Kitty::transmitFile(print::Builder* pPb, u32 id, const ::Image& cover)
+{
+    const char* ntsTmpDir = ::getenv("TMPDIR");
+    if (!ntsTmpDir || !*ntsTmpDir) ntsTmpDir = "/tmp";
+
+    /* Terminal only reads files with this in the name from a temp dir, and deletes them. */
+    char aPath[512] {};
+    const isize pathSize = print::toBuffer(aPath, sizeof(aPath) - 1, "{}/" PROJECT_NAME "-tty-graphics-protocol-XXXXXX", ntsTmpDir);
+    aPath[pathSize] = '\0';
+
+    const int fd = mkstemp(aPath);
+    if (fd < 0)
+    {
+        LogDebug{"kitty: mkstemp('{}'): {}\n", aPath, strerror(errno)};
+        return false;
+    }
+
+    const u8* p = cover.pBuff;
+    isize nLeft = isize(cover.width) * cover.height * 3;
+    while (nLeft > 0)
+    {
+        const ssize_t n = write(fd, p, nLeft);
+        if (n <= 0) break;
+        p += n;
+        nLeft -= n;
+    }
+    ::close(fd);
+
+    if (nLeft > 0)
+    {
+        unlink(aPath);
+        return false;
+    }
+
+    pPb->pushFmt("\x1b_Ga=t,i={},f=24,s={},v={},t=t,q=2;", id, cover.width, cover.height);
+    pushBase64(pPb, {reinterpret_cast<const u8*>(aPath), pathSize});
+    pPb->push("\x1b\\");
+
+    return true;
+}
+
+} /* namespace platform::chafa */
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "chafa.hh"
+
+namespace platform::chafa
+{
+
+/* Kitty graphics protocol without going through chafa: each cover is transmitted once under an id made from its path
+ * and redraws only place it again, the terminal does the scaling. Local sessions hand over the pixels in a temp file
+ * instead of base64 through the pty. ui thread only, paths must outlive it. */
+struct Kitty
+{
+    static constexpr isize MAX_UPLOADED = 16; /* Older ones get deleted from the terminal. */
+    static constexpr isize CHUNK_SIZE = 4096; /* Of base64 per escape code, protocol's limit. */
+
+    struct Uploaded
+    {
+        StringView svPath {};
+        u32 id {}; /* Hash of svPath, 0 if the slot is free. */
+        int width {};
+        int height {};
+    };
+
+    Uploaded m_aUploaded[MAX_UPLOADED] {};
+    isize m_nextUploadedI {}; /* Oldest one gets replaced. */
+    bool m_bEnabled = false; /* Terminal speaks kitty graphics. */
+    bool m_bTempFile = false;
+
+    /* */
+
+    void start(); /* After platform::chafa::start(). */
+    [[nodiscard]] Image place(IAllocator* pAlloc, StringView svPath, int termHeight, int termWidth); /* For TextBuff::image(), transmits if needed. */
+
+protected:
+    [[nodiscard]] Uploaded* search(StringView svPath);
+    void transmit(print::Builder* pPb, u32 id, const ::Image& cover);
+    [[nodiscard]] bool transmitFile(print::Builder* pPb, u32 id, const ::Image& cover);
+};
+
+} /* namespace platform::chafa */
@@ -23,6 +23,25 @@ struct TermSize
     int heightPixels {};
 };
 
+/* Detected once, prints reuse the canvas while the geometry stays the same. */
+struct Context
+{
+    Mutex m_mtx {};
+    ChafaTermInfo* m_pTermInfo {};
+    ChafaCanvasMode m_eMode {};
+    ChafaPixelMode m_ePixelMode {};
+    ChafaSymbolMap* m_pSymbolMap {};
+    ChafaCanvasConfig* m_pConfig {}; /* Without geometry. */
+    ChafaCanvas* m_pCanvas {};
+    int m_widthCells {}; /* Of m_pCanvas. */
+    int m_heightCells {};
+    int m_cellWidth {};
+    int m_cellHeight {};
+    bool m_bStarted = false;
+};
+
+static Context s_ctx {};
+
 [[nodiscard]] static int
 formatToPixelType(const IMAGE_PIXEL_FORMAT eFormat)
 {
@@ -174,6 +193,98 @@ detectTerminal(ChafaTermInfo** ppTermInfo, ChafaCanvasMode* pMode, ChafaPixelMod
     LogDebug("pixelMode: {}\n", (int)pixelMode);
 }
 
+void
+start()
+{
+    new(&s_ctx.m_mtx) Mutex {Mutex::TYPE::PLAIN};
+
+    detectTerminal(&s_ctx.m_pTermInfo, &s_ctx.m_eMode, &s_ctx.m_ePixelMode);
+
+    /* Specify the symbols we want */
+    s_ctx.m_pSymbolMap = chafa_symbol_map_new();
+    chafa_symbol_map_add_by_tags(s_ctx.m_pSymbolMap, CHAFA_SYMBOL_TAG_BLOCK);
+
+    /* Canvas size gets set on a copy for each new geometry */
+    s_ctx.m_pConfig = chafa_canvas_config_new();
+    chafa_canvas_config_set_canvas_mode(s_ctx.m_pConfig, s_ctx.m_eMode);
+    chafa_canvas_config_set_pixel_mode(s_ctx.m_pConfig, s_ctx.m_ePixelMode);
+    chafa_canvas_config_set_symbol_map(s_ctx.m_pConfig, s_ctx.m_pSymbolMap);
+
+    s_ctx.m_bStarted = true;
+}
+
+void
+destroy() noexcept
+{
+    if (!s_ctx.m_bStarted) return;
+
+    if (s_ctx.m_pCanvas) chafa_canvas_unref(s_ctx.m_pCanvas);
+    chafa_canvas_config_unref(s_ctx.m_pConfig);
+    chafa_symbol_map_unref(s_ctx.m_pSymbolMap);
+
+    /* struct ChafaTermInfo
+     * {
+     *     gint refs;
+     *     gchar *name;
+     *     gchar seq_str [CHAFA_TERM_SEQ_MAX] [CHAFA_TERM_SEQ_LENGTH_MAX];
+     *     SeqArgInfo seq_args [CHAFA_TERM_SEQ_MAX] [CHAFA_TERM_SEQ_ARGS_MAX];
+     *     gchar *unparsed_str [CHAFA_TERM_SEQ_MAX];
+     *     guint8 pixel_passthrough_needed [CHAFA_PIXEL_MODE_MAX];
+     *     guint8 inherit_seq [CHAFA_TERM_SEQ_MAX];
+     *     ChafaSymbolTags safe_symbol_tags;
+     * }; */
+
+    /* BUG: fix for the chafa leak: https://github.com/hpjansson/chafa/commit/05e76092c459421131cca8d512df693d3fd98b99 */
+    /* first 4 bytes is the ref count, prints take refs they never drop */
+    for (int refs = *reinterpret_cast<int*>(s_ctx.m_pTermInfo); refs > 0; --refs)
+        chafa_term_info_unref(s_ctx.m_pTermInfo);
+
+    s_ctx.m_mtx.destroy();
+    s_ctx = {};
+}
+
+void
+termModes(ChafaCanvasMode* pMode, ChafaPixelMode* pPixelMode)
+{
+    *pMode = s_ctx.m_eMode;
+    *pPixelMode = s_ctx.m_ePixelMode;
+}
+
+/* s_ctx.m_mtx must be locked. */
+static ChafaCanvas*
+canvas(const int widthCells, const int heightCells, const int cellWidth, const int cellHeight)
+{
+    if (s_ctx.m_pCanvas &&
+        s_ctx.m_widthCells == widthCells && s_ctx.m_heightCells == heightCells &&
+        s_ctx.m_cellWidth == cellWidth && s_ctx.m_cellHeight == cellHeight
+    )
+    {
+        return s_ctx.m_pCanvas;
+    }
+
+    ChafaCanvasConfig* pConfig = chafa_canvas_config_copy(s_ctx.m_pConfig);
+    defer( chafa_canvas_config_unref(pConfig) );
+
+    chafa_canvas_config_set_geometry(pConfig, widthCells, heightCells);
+
+    if (cellWidth > 0 && cellHeight > 0)
+    {
+        /* We know the pixel dimensions of each cell. Store it in the config. */
+        chafa_canvas_config_set_cell_geometry(pConfig, cellWidth, cellHeight);
+    }
+
+    if (s_ctx.m_pCanvas) chafa_canvas_unref(s_ctx.m_pCanvas);
+    s_ctx.m_pCanvas = chafa_canvas_new(pConfig);
+    s_ctx.m_widthCells = widthCells;
+    s_ctx.m_heightCells = heightCells;
+    s_ctx.m_cellWidth = cellWidth;
+    s_ctx.m_cellHeight = cellHeight;
+
+    LogDebug("new canvas: {}x{} cells\n", widthCells, heightCells);
+
+    return s_ctx.m_pCanvas;
+}
+
 static StringLines
 getString(
     const IMAGE_LAYOUT eLayout,
@@ -188,66 +299,20 @@ getString(
     const int cellHeight
 )
 {
-    ChafaTermInfo* pTermInfo;
-    ChafaCanvasMode mode;
-    ChafaPixelMode ePixelMode;
-    ChafaSymbolMap* pSymbolMap;
-    ChafaCanvasConfig* pConfig;
-    ChafaCanvas* pCanvas;
+    ADT_ASSERT(s_ctx.m_bStarted, "platform::chafa::start() wasn't called");
 
-    detectTerminal(&pTermInfo, &mode, &ePixelMode);
+    /* One canvas for the ui and the ImageCache thread, chafa spreads each draw over its own threads anyway. */
+    LockScope lock {&s_ctx.m_mtx};
 
-    /* Specify the symbols we want */
-    pSymbolMap = chafa_symbol_map_new();
-    chafa_symbol_map_add_by_tags(pSymbolMap, CHAFA_SYMBOL_TAG_BLOCK);
-
-    /* Set up a configuration with the symbols and the canvas size in characters */
-    pConfig = chafa_canvas_config_new();
-    chafa_canvas_config_set_canvas_mode(pConfig, mode);
-    chafa_canvas_config_set_pixel_mode(pConfig, ePixelMode);
-    chafa_canvas_config_set_geometry(pConfig, widthCells, heightCells);
-    chafa_canvas_config_set_symbol_map(pConfig, pSymbolMap);
-
-    if (cellWidth > 0 && cellHeight > 0)
-    {
-        /* We know the pixel dimensions of each cell. Store it in the config. */
-        chafa_canvas_config_set_cell_geometry(pConfig, cellWidth, cellHeight);
-    }
-
-    /* Create canvas */
-    pCanvas = chafa_canvas_new(pConfig);
+    ChafaCanvas* pCanvas = canvas(widthCells, heightCells, cellWidth, cellHeight);
 
     /* Draw pixels to the canvas */
     chafa_canvas_draw_all_pixels(pCanvas, ePixelType, (u8*)pPixels, pixWidth, pixHeight, pixRowStride);
 
-    defer(
-        chafa_canvas_unref(pCanvas);
-        chafa_canvas_config_unref(pConfig);
-        chafa_symbol_map_unref(pSymbolMap);
-
-        /* struct ChafaTermInfo
-         * {
-         *     gint refs;
-         *     gchar *name;
-         *     gchar seq_str [CHAFA_TERM_SEQ_MAX] [CHAFA_TERM_SEQ_LENGTH_MAX];
-         *     SeqArgInfo seq_args [CHAFA_TERM_SEQ_MAX] [CHAFA_TERM_SEQ_ARGS_MAX];
-         *     gchar *unparsed_str [CHAFA_TERM_SEQ_MAX];
-         *     guint8 pixel_passthrough_needed [CHAFA_PIXEL_MODE_MAX];
-         *     guint8 inherit_seq [CHAFA_TERM_SEQ_MAX];
-         *     ChafaSymbolTags safe_symbol_tags;
-         * }; */
-
-        /* BUG: fix for the chafa leak: https://github.com/hpjansson/chafa/commit/05e76092c459421131cca8d512df693d3fd98b99 */
-        /* first 4 bytes is the ref count */
-        int refs = *reinterpret_cast<int*>(pTermInfo);
-        chafa_term_info_unref(pTermInfo);
-        if (refs >= 2) chafa_term_info_unref(pTermInfo);
-    );
-
     if (eLayout == IMAGE_LAYOUT::RAW)
     {
         /* Build printable strings */
-        auto* pGStr = chafa_canvas_print(pCanvas, pTermInfo);
+        auto* pGStr = chafa_canvas_print(pCanvas, s_ctx.m_pTermInfo);
 
         return {.pGStr = pGStr};
     }
@@ -255,7 +320,7 @@ getString(
     {
 #ifdef OPT_CHAFA_SYMBOLS
 
-        gchar** ppRows = chafa_canvas_print_rows_strv(pCanvas, pTermInfo);
+        gchar** ppRows = chafa_canvas_print_rows_strv(pCanvas, s_ctx.m_pTermInfo);
         /* https://github.com/hpjansson/chafa/pull/240/commits/28ba1760b4aa9626cef38887479f22266ab1cad9 */
         /* defer( chafa_term_info_unref(pTermInfo) ); */
 
@@ -270,33 +335,70 @@ getString(
     }
 }
 
-Image
-allocImage(IAllocator* pAlloc, IMAGE_LAYOUT eLayout, const ::Image img, int termHeight, int termWidth)
+void
+cellPixelSize(int* pWidth, int* pHeight)
 {
-    if (img.height <= 0 || img.width <= 0) return {};
-
     TermSize termSize {};
     getTTYSize(&termSize);
 
-    f64 fontRatio = app::g_config.fontAspectRatio;
-    int cellWidth = -1, cellHeight = -1; /* Size of each character cell, in pixels */
-    int widthCells {}, heightCells {}; /* Size of output image, in cells */
-
-    if (termWidth > 0 && termHeight > 0 && termSize.widthPixels > 0 && termSize.heightPixels > 0)
+    if (termSize.widthPixels > 0 && termSize.heightPixels > 0 && termSize.widthCells > 0 && termSize.heightCells > 0)
+    {
+        *pWidth = termSize.widthPixels / termSize.widthCells;
+        *pHeight = termSize.heightPixels / termSize.heightCells;
+    }
+    else
     {
-        cellWidth = termSize.widthPixels / termSize.widthCells;
-        cellHeight = termSize.heightPixels / termSize.heightCells;
-        fontRatio = f64(cellWidth) / f64(cellHeight);
+        *pWidth = *pHeight = -1;
     }
+}
 
-    widthCells = termWidth;
-    heightCells = termHeight;
+void
+fitCells(int pixWidth, int pixHeight, int termHeight, int termWidth, int* pWidthCells, int* pHeightCells)
+{
+    f64 fontRatio = app::g_config.fontAspectRatio;
+
+    int cellWidth {}, cellHeight {};
+    cellPixelSize(&cellWidth, &cellHeight);
+    if (cellWidth > 0 && cellHeight > 0) fontRatio = f64(cellWidth) / f64(cellHeight);
+
+    *pWidthCells = termWidth;
+    *pHeightCells = termHeight;
 
     chafa_calc_canvas_geometry(
-        img.width, img.height,
-        &widthCells, &heightCells,
+        pixWidth, pixHeight,
+        pWidthCells, pHeightCells,
         fontRatio, true, false
     );
+}
+
+void
+targetPixelSize(int termHeight, int termWidth, int* pWidth, int* pHeight)
+{
+    int cellWidth {}, cellHeight {};
+    cellPixelSize(&cellWidth, &cellHeight);
+
+    /* Guess when the terminal doesn't report pixels, too big only costs a bit of scaling work. */
+    if (cellWidth <= 0 || cellHeight <= 0)
+    {
+        cellHeight = 20;
+        cellWidth = utils::max(int(cellHeight * app::g_config.fontAspectRatio), 1);
+    }
+
+    *pWidth = utils::max(termWidth, 1) * cellWidth;
+    *pHeight = utils::max(termHeight, 1) * cellHeight;
+}
+
+Image
+allocImage(IAllocator* pAlloc, IMAGE_LAYOUT eLayout, const ::Image img, int termHeight, int termWidth)
+{
+    if (img.height <= 0 || img.width <= 0) return {};
+
+    int cellWidth = -1, cellHeight = -1; /* Size of each character cell, in pixels */
+    int widthCells {}, heightCells {}; /* Size of output image, in cells */
+
+    if (termWidth > 0 && termHeight > 0) cellPixelSize(&cellWidth, &cellHeight);
+
+    fitCells(img.width, img.height, termHeight, termWidth, &widthCells, &heightCells);
 
     LogDebug("formatSize: {}\n", getFormatChannelNumber(img.eFormat));
 
@@ -359,4 +461,55 @@ allocImage(IAllocator* pAlloc, IMAGE_LAYOUT eLayout, const ::Image img, int term
     }
 }
 
+Image
+copyImage(IAllocator* pAlloc, const Image& img)
+{
+    Image ret {.eLayout = img.eLayout, .width = img.width, .height = img.height};
+
+    if (img.eLayout == IMAGE_LAYOUT::RAW)
+    {
+        ret.uData.sRaw = String(pAlloc, img.uData.sRaw);
+    }
+    else
+    {
+        const Vec<String>& vLines = img.uData.vLines;
+        Vec<String> vCopy(pAlloc, vLines.size());
+        vCopy.setSize(pAlloc, vLines.size());
+
+        for (isize i = 0; i < vLines.size(); ++i)
+            vCopy[i] = String(pAlloc, vLines[i]);
+
+        ret.uData.vLines = vCopy;
+    }
+
+    return ret;
+}
+
+void
+freeImage(IAllocator* pAlloc, Image* pImg) noexcept
+{
+    if (pImg->eLayout == IMAGE_LAYOUT::RAW)
+    {
+        pImg->uData.sRaw.destroy(pAlloc);
+    }
+    else
+    {
+        for (String& s : pImg->uData.vLines) s.destroy(pAlloc);
+        pImg->uData.vLines.destroy(pAlloc);
+    }
+
+    *pImg = {};
+}
+
+isize
+imageBytes(const Image& img)
+{
+    if (img.eLayout == IMAGE_LAYOUT::RAW) return img.uData.sRaw.size();
+
+    isize n = img.uData.vLines.size() * isize(sizeof(String));
+    for (const String& s : img.uData.vLines) n += s.size();
+
+    return n;
+}
+
 } /* namespace platform::chafa */
@@ -22,7 +22,24 @@ struct Image
 };
 
 [[nodiscard]] Image allocImage(IAllocator* pAlloc, IMAGE_LAYOUT eLayout, const ::Image img, int termHeight, int termWidth);
+[[nodiscard]] Image copyImage(IAllocator* pAlloc, const Image& img);
+void freeImage(IAllocator* pAlloc, Image* pImg) noexcept;
+[[nodiscard]] isize imageBytes(const Image& img); /* Memory held by the strings. */
+
+/* Pixels of one terminal cell, -1 if the terminal doesn't report them. */
+void cellPixelSize(int* pWidth, int* pHeight);
+
+/* Cells of a termHeight x termWidth area a picture fills keeping its aspect. */
+void fitCells(int pixWidth, int pixHeight, int termHeight, int termWidth, int* pWidthCells, int* pHeightCells);
+
+/* Pixel size an image drawn with allocImage() can fill, covers don't need to be scaled down beyond it. */
+void targetPixelSize(int termHeight, int termWidth, int* pWidth, int* pHeight);
 
 void detectTerminal(ChafaTermInfo** ppTermInfo, ChafaCanvasMode* pMode, ChafaPixelMode* pPixelMode);
 
+/* Detects the terminal and sets up what every allocImage() shares. */
+void start();
+void destroy() noexcept;
+void termModes(ChafaCanvasMode* pMode, ChafaPixelMode* pPixelMode); /* Detected by start(). */
+
 } /* namespace platform::chafa */
@@ -6,18 +6,12 @@ namespace platform::coreaudio
 {
 
 void
-Mixer::setConfig(f64 sampleRate, int nChannels, bool bSaveNewConfig)
+Mixer::setNChannels(int nChannels)
 {
-    sampleRate = utils::clamp(sampleRate, f64(app::g_config.minSampleRate), f64(app::g_config.maxSampleRate));
-
-    if (bSaveNewConfig)
-    {
-        m_changedSampleRate = m_sampleRate = sampleRate;
-        m_nChannels = nChannels;
-    }
+    m_nDeviceChannels = nChannels;
 
     AudioStreamBasicDescription desk {};
-    desk.mSampleRate = sampleRate;
+    desk.mSampleRate = m_deviceSampleRate;
     desk.mFormatID = kAudioFormatLinearPCM;
     desk.mFormatFlags = kAudioFormatFlagIsFloat | kAudioFormatFlagIsPacked;
     desk.mFramesPerPacket = 1;
@@ -46,13 +40,9 @@ Mixer::writeCallBack(
 )
 {
     f32 *pDest = static_cast<f32*>(pIOData->mBuffers[0].mData);
-    const f32 vol = m_bMuted ? 0.0f : std::pow(m_volume * (1.f/100.f), 3.0f);
     const isize nSamplesRequested = inNumberFrames * m_nChannels;
     m_ringBuff.pop({pDest, nSamplesRequested});
 
-    for (isize sampleI = 0; sampleI < nSamplesRequested; ++sampleI)
-        pDest[sampleI] *= vol;
-
     return noErr;
 }
 
@@ -70,7 +60,7 @@ Mixer::init()
     AudioComponentInstanceNew(comp, &m_unit);
 
     AudioStreamBasicDescription streamFormat {};
-    streamFormat.mSampleRate = m_sampleRate;
+    streamFormat.mSampleRate = m_deviceSampleRate;
     streamFormat.mFormatID = kAudioFormatLinearPCM;
     streamFormat.mFormatFlags = kAudioFormatFlagIsFloat | kAudioFormatFlagIsPacked;
     streamFormat.mFramesPerPacket = 1;
@@ -118,16 +108,12 @@ Mixer::deinit()
 bool
 Mixer::play(StringView svPath)
 {
-    const f64 prevSpeed = f64(m_changedSampleRate) / f64(m_sampleRate);
-
     pause(true);
 
     if (!playFinal(svPath)) return false;
 
-    setConfig(app::decoder().getSampleRate(), app::decoder().getChannelsCount(), true);
-
-    if (!utils::floatEq(prevSpeed, 1.0))
-        changeSampleRate(f64(m_sampleRate) * prevSpeed, false);
+    /* Rate is handled by the resampler, only a different channel count needs new params. */
+    if (m_nChannels != m_nDeviceChannels) setNChannels(m_nChannels);
 
     pause(false);
 
@@ -146,15 +132,4 @@ Mixer::pause(bool bPause)
     else AudioOutputUnitStart(m_unit);
 }
 
-void
-Mixer::changeSampleRate(u64 sampleRate, bool bSave)
-{
-    pause(true);
-    setConfig(sampleRate, m_nChannels, false);
-    pause(false);
-
-    if (bSave) m_sampleRate = sampleRate;
-    m_changedSampleRate = sampleRate;
-}
-
 } /* namespace platform::apple */
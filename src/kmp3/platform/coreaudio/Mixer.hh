@@ -17,11 +17,10 @@ struct Mixer : public audio::IMixer
     virtual void deinit() override;
     virtual bool play(StringView svPath) override;
     virtual void pause(bool bPause) override;
-    virtual void changeSampleRate(u64 sampleRate, bool bSave) override;
 
     /* */
 
-    void setConfig(f64 sampleRate, int nChannels, bool bSaveNewConfig);
+    void setNChannels(int nChannels);
 
     OSStatus writeCallBack(
         AudioUnitRenderActionFlags* pIOActionFlags,
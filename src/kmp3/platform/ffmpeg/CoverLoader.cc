@@ -0,0 +1,660 @@
+#ifdef OPT_CHAFA
+
+#include "CoverLoader.hh"
+#include "dll.hh"
+
+#include "adt/Directory.hh"
+#include "adt/sort.hh"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include <cctype>
+
+namespace platform::ffmpeg
+{
+
+void
+CoverLoader::start(StringView svCacheDir)
+{
+    new(&m_mtx) Mutex {Mutex::TYPE::PLAIN};
+    new(&m_cnd) CndVar {INIT};
+    new(&m_mFolderPictures) Map<StringView, String> {Gpa::inst()};
+
+    if (svCacheDir.size() > 0)
+    {
+        char aPath[1024] {};
+        const isize n = print::toBuffer(aPath, sizeof(aPath) - 1, "{}/covers", svCacheDir);
+        aPath[n] = '\0';
+
+        if (mkdir(aPath, 0755) == 0 || errno == EEXIST) m_sDiskDir = String(Gpa::inst(), StringView(aPath, n));
+        else LogWarn{"failed to create '{}': {}\n", aPath, strerror(errno)};
+    }
+
+    m_bStarted = true;
+    new(&m_thrd) Thread {
+        [](void* p) { return static_cast<CoverLoader*>(p)->loop(); },
+        this
+    };
+}
+
+void
+CoverLoader::destroy() noexcept
+{
+    if (!m_bStarted) return;
+
+    {
+        LockScope lock {&m_mtx};
+        m_atom_bQuit.store(true, atomic::ORDER::RELEASE);
+        m_cnd.signal();
+    }
+    m_thrd.join();
+
+    for (Entry& e : m_aEntries) freeEntry(&e);
+    m_sDiskDir.destroy(Gpa::inst());
+    for (auto& kv : m_mFolderPictures) kv.val.destroy(Gpa::inst());
+    m_mFolderPictures.destroy(Gpa::inst());
+    m_mtx.destroy();
+    m_cnd.destroy();
+    m_bStarted = false;
+}
+
+void
+CoverLoader::freeEntry(Entry* pEntry) noexcept
+{
+    if (pEntry->pPacket) dll::av_packet_free(&pEntry->pPacket);
+    if (pEntry->pScaled) dll::av_frame_free(&pEntry->pScaled);
+    *pEntry = {};
+}
+
+CoverLoader::Entry*
+CoverLoader::search(StringView svPath)
+{
+    for (Entry& e : m_aEntries)
+        if (e.svPath.size() > 0 && e.svPath == svPath) return &e;
+
+    return nullptr;
+}
+
+CoverLoader::Entry*
+CoverLoader::nextJob()
+{
+    for (isize i = 1; i <= MAX_CACHED; ++i)
+    {
+        Entry& e = m_aEntries[(m_nextEntryI - i + MAX_CACHED) % MAX_CACHED];
+        if (e.svPath.size() == 0 || e.bFailed) continue;
+
+        if (!e.pPacket || !e.pScaled || e.targetWidth != m_targetWidth || e.targetHeight != m_targetHeight)
+            return &e;
+    }
+
+    return nullptr;
+}
+
+bool
+CoverLoader::shareScaled(Entry* pJob)
+{
+    for (const Entry& e : m_aEntries)
+    {
+        if (&e == pJob || !e.pScaled || e.hash != pJob->hash ||
+            e.targetWidth != m_targetWidth || e.targetHeight != m_targetHeight
+        )
+        {
+            continue;
+        }
+
+        AVFrame* pScaled = dll::av_frame_clone(e.pScaled); /* Refcounted, no copy. */
+        if (!pScaled) return false;
+
+        if (pJob->pScaled) dll::av_frame_free(&pJob->pScaled);
+        pJob->pScaled = pScaled;
+        pJob->targetWidth = m_targetWidth;
+        pJob->targetHeight = m_targetHeight;
+        return true;
+    }
+
+    return false;
+}
+
+void
+CoverLoader::request(StringView svPath, const AVStream* pStream)
+{
+    if (!m_bStarted || pStream->attached_pic.size <= 0) return;
+
+    const AVPacket& pic = pStream->attached_pic;
+    const u64 hash = hash::xxh64::hash(pic.data, pic.size, 0);
+
+    LockScope lock {&m_mtx};
+
+    if (search(svPath)) return;
+
+    Entry& e = m_aEntries[m_nextEntryI];
+    freeEntry(&e);
+
+    /* Just a reference, the data stays after the song's demuxer is closed. */
+    e.pPacket = dll::av_packet_alloc();
+    if (!e.pPacket || dll::av_packet_ref(e.pPacket, &pStream->attached_pic) < 0)
+    {
+        freeEntry(&e);
+        return;
+    }
+
+    e.svPath = svPath;
+    e.eCodecId = pStream->codecpar->codec_id;
+    e.hash = hash;
+    e.srcWidth = pStream->codecpar->width;
+    e.srcHeight = pStream->codecpar->height;
+    m_nextEntryI = (m_nextEntryI + 1) % MAX_CACHED;
+    m_cnd.signal();
+}
+
+void
+CoverLoader::requestFolder(StringView svPath)
+{
+    if (!m_bStarted) return;
+
+    LockScope lock {&m_mtx};
+
+    if (search(svPath)) return;
+
+    Entry& e = m_aEntries[m_nextEntryI];
+    freeEntry(&e);
+
+    /* Directory gets looked at by the loader thread. */
+    e.svPath = svPath;
+    e.bFolder = true;
+    m_nextEntryI = (m_nextEntryI + 1) % MAX_CACHED;
+    m_cnd.signal();
+}
+
+void
+CoverLoader::setTargetSize(int width, int height)
+{
+    if (!m_bStarted) return;
+
+    /* Every terminal resize would scale (and save) the picture again otherwise. */
+    width = utils::max(TARGET_STEP, (width + TARGET_STEP - 1) / TARGET_STEP * TARGET_STEP);
+    height = utils::max(TARGET_STEP, (height + TARGET_STEP - 1) / TARGET_STEP * TARGET_STEP);
+
+    LockScope lock {&m_mtx};
+
+    if (width == m_targetWidth && height == m_targetHeight) return;
+
+    m_targetWidth = width;
+    m_targetHeight = height;
+    m_cnd.signal();
+}
+
+bool
+CoverLoader::hasCover(StringView svPath)
+{
+    if (!m_bStarted) return false;
+
+    LockScope lock {&m_mtx};
+
+    const Entry* pEntry = search(svPath);
+    return pEntry && !pEntry->bFailed && (pEntry->pPacket || !pEntry->bFolder);
+}
+
+bool
+CoverLoader::coverSize(StringView svPath, int* pWidth, int* pHeight)
+{
+    if (!m_bStarted) return false;
+
+    LockScope lock {&m_mtx};
+
+    const Entry* pEntry = search(svPath);
+    if (!pEntry || !pEntry->pScaled) return false;
+
+    *pWidth = pEntry->pScaled->width;
+    *pHeight = pEntry->pScaled->height;
+    return true;
+}
+
+Image
+CoverLoader::copyCover(IAllocator* pAlloc, StringView svPath)
+{
+    if (!m_bStarted) return {};
+
+    LockScope lock {&m_mtx};
+
+    const Entry* pEntry = search(svPath);
+    if (!pEntry || !pEntry->pScaled) return {};
+
+    /* Loader may replace the frame any time after unlocking, rows get packed too. */
+    const AVFrame* pFrame = pEntry->pScaled;
+    const isize rowSize = isize(pFrame->width) * 3;
+    u8* pBuff = pAlloc->mallocV<u8>(rowSize * pFrame->height);
+
+    for (int y = 0; y < pFrame->height; ++y)
+        utils::memCopy(pBuff + y*rowSize, pFrame->data[0] + isize(y)*pFrame->linesize[0], rowSize);
+
+    return {
+        .pBuff = pBuff,
+        .width = pFrame->width,
+        .height = pFrame->height,
+        .eFormat = IMAGE_PIXEL_FORMAT::RGB8,
+    };
+}
+
+THREAD_STATUS
+CoverLoader::loop()
+{
+    if (m_sDiskDir.size() > 0) pruneThumbnails();
+
+    while (true)
+    {
+        Entry job {};
+        int targetWidth {}, targetHeight {};
+        {
+            LockScope lock {&m_mtx};
+
+            Entry* pJob {};
+            while (!m_atom_bQuit.load(atomic::ORDER::ACQUIRE) && !(pJob = nextJob()))
+                m_cnd.wait(&m_mtx);
+
+            if (m_atom_bQuit.load(atomic::ORDER::ACQUIRE)) break;
+
+            if (!pJob->pPacket)
+            {
+                /* Folder picture isn't read yet, gets decoded like attached ones on the next round. */
+                job = {.svPath = pJob->svPath, .bFolder = true};
+            }
+            else if (shareScaled(pJob))
+            {
+                m_atom_nPublished.fetchAdd(1, atomic::ORDER::RELEASE);
+                continue;
+            }
+            else
+            {
+                /* Own reference, the entry can get replaced while decoding. */
+                job = {.svPath = pJob->svPath, .eCodecId = pJob->eCodecId, .hash = pJob->hash, .srcWidth = pJob->srcWidth, .srcHeight = pJob->srcHeight};
+                job.pPacket = dll::av_packet_alloc();
+                if (!job.pPacket || dll::av_packet_ref(job.pPacket, pJob->pPacket) < 0)
+                {
+                    freeEntry(&job);
+                    pJob->bFailed = true;
+                    continue;
+                }
+
+                targetWidth = m_targetWidth;
+                targetHeight = m_targetHeight;
+            }
+        }
+
+        if (job.bFolder)
+        {
+            readFolderPicture(job.svPath);
+            continue;
+        }
+
+        const time::Type t0 = time::nowUS();
+        AVFrame* pScaled = loadThumbnail(job.hash, targetWidth, targetHeight);
+        if (!pScaled)
+        {
+            pScaled = decodeScaled(job, targetWidth, targetHeight);
+            if (pScaled) saveThumbnail(job.hash, targetWidth, targetHeight, pScaled);
+        }
+        const StringView svPath = job.svPath;
+        freeEntry(&job);
+
+        LockScope lock {&m_mtx};
+
+        Entry* pEntry = search(svPath);
+        if (!pEntry)
+        {
+            if (pScaled) dll::av_frame_free(&pScaled);
+            continue;
+        }
+
+        if (!pScaled)
+        {
+            LogDebug{"cover: failed to decode '{}'\n", svPath};
+            pEntry->bFailed = true;
+            continue;
+        }
+
+        LogDebug{"cover: '{}', {}x{} in {} ms\n", svPath, pScaled->width, pScaled->height, (time::nowUS() - t0) / 1000};
+
+        if (pEntry->pScaled) dll::av_frame_free(&pEntry->pScaled);
+        pEntry->pScaled = pScaled;
+        pEntry->targetWidth = targetWidth;
+        pEntry->targetHeight = targetHeight;
+        m_atom_nPublished.fetchAdd(1, atomic::ORDER::RELEASE);
+    }
+
+    return THREAD_STATUS(0);
+}
+
+/* In order of preference. */
+static constexpr StringView s_aFolderPictureNames[] {"cover", "folder", "front", "album"};
+
+static bool
+equalsNoCase(StringView svA, StringView svB)
+{
+    if (svA.size() != svB.size()) return false;
+
+    for (isize i = 0; i < svA.size(); ++i)
+        if (std::tolower(u8(svA[i])) != std::tolower(u8(svB[i]))) return false;
+
+    return true;
+}
+
+static AVCodecID
+pictureCodec(StringView svFile)
+{
+    const isize dotI = svFile.lastOf('.');
+    if (dotI == NPOS) return AV_CODEC_ID_NONE;
+
+    const StringView svExt {svFile.data() + dotI + 1, svFile.size() - dotI - 1};
+    if (equalsNoCase(svExt, "jpg") || equalsNoCase(svExt, "jpeg")) return AV_CODEC_ID_MJPEG;
+    if (equalsNoCase(svExt, "png")) return AV_CODEC_ID_PNG;
+
+    return AV_CODEC_ID_NONE;
+}
+
+StringView
+CoverLoader::findFolderPicture(StringView svDir)
+{
+    auto found = m_mFolderPictures.search(svDir);
+    if (found) return found.value();
+
+    String sDir = String(Gpa::inst(), svDir);
+    defer( sDir.destroy(Gpa::inst()) );
+
+    String sPicture {};
+    isize bestRank = utils::size(s_aFolderPictureNames);
+
+    Directory dir {sDir.data()};
+    if (dir)
+    {
+        for (const StringView svFile : dir)
+        {
+            if (pictureCodec(svFile) == AV_CODEC_ID_NONE) continue;
+
+            const StringView svStem {const_cast<char*>(svFile.data()), svFile.lastOf('.')};
+            for (isize rank = 0; rank < bestRank; ++rank)
+            {
+                if (!equalsNoCase(svStem, s_aFolderPictureNames[rank])) continue;
+
+                sPicture.destroy(Gpa::inst());
+                sPicture = file::appendDirPath(Gpa::inst(), svDir, svFile);
+                bestRank = rank;
+                break;
+            }
+        }
+
+        dir.close();
+    }
+
+    LogDebug{"cover: folder '{}', picture: '{}'\n", svDir, sPicture};
+
+    /* Negative results are kept too, other songs from here don't open it again. */
+    m_mFolderPictures.insert(Gpa::inst(), svDir, sPicture);
+    return sPicture;
+}
+
+void
+CoverLoader::readFolderPicture(StringView svPath)
+{
+    const isize slashI = svPath.lastOf('/');
+    const StringView svDir = slashI == NPOS ? StringView {"."} : StringView {svPath.data(), slashI};
+
+    const StringView svPicture = findFolderPicture(svDir);
+
+    AVPacket* pPacket {};
+    if (svPicture.size() > 0)
+    {
+        String sFile = file::load(Gpa::inst(), svPicture.data());
+        defer( sFile.destroy(Gpa::inst()) );
+
+        pPacket = dll::av_packet_alloc();
+        if (sFile.size() <= 0 || !pPacket || dll::av_new_packet(pPacket, int(sFile.size())) < 0)
+        {
+            if (pPacket) dll::av_packet_free(&pPacket);
+        }
+        else
+        {
+            utils::memCopy(pPacket->data, reinterpret_cast<const u8*>(sFile.data()), sFile.size());
+        }
+    }
+
+    LockScope lock {&m_mtx};
+
+    Entry* pEntry = search(svPath);
+    if (!pEntry || pEntry->pPacket)
+    {
+        if (pPacket) dll::av_packet_free(&pPacket);
+        return;
+    }
+
+    if (!pPacket)
+    {
+        pEntry->bFailed = true;
+        return;
+    }
+
+    pEntry->pPacket = pPacket;
+    pEntry->eCodecId = pictureCodec(svPicture);
+    pEntry->hash = hash::xxh64::hash(pPacket->data, pPacket->size, 0);
+
+    /* Layout makes room for it now. */
+    m_atom_nPublished.fetchAdd(1, atomic::ORDER::RELEASE);
+}
+
+isize
+CoverLoader::thumbnailPath(Span<char> spBuff, u64 hash, int targetWidth, int targetHeight)
+{
+    if (m_sDiskDir.size() == 0) return 0;
+
+    const isize n = print::toSpan({spBuff.data(), spBuff.size() - 1}, "{}/{:x}-{}x{}.rgb", m_sDiskDir, hash, targetWidth, targetHeight);
+    spBuff[n] = '\0';
+
+    return n;
+}
+
+AVFrame*
+CoverLoader::loadThumbnail(u64 hash, int targetWidth, int targetHeight)
+{
+    char aPath[1024] {};
+    if (thumbnailPath(aPath, hash, targetWidth, targetHeight) <= 0) return nullptr;
+
+    String sFile = file::load(Gpa::inst(), aPath);
+    defer( sFile.destroy(Gpa::inst()) );
+    if (sFile.size() < isize(sizeof(ThumbnailHeader))) return nullptr;
+
+    ThumbnailHeader header {};
+    utils::memCopy(&header, reinterpret_cast<const ThumbnailHeader*>(sFile.data()), 1);
+
+    const isize rowSize = isize(header.width) * 3;
+    if (header.magic != THUMBNAIL_MAGIC || header.width == 0 || header.height == 0 ||
+        sFile.size() != isize(sizeof(ThumbnailHeader)) + rowSize * header.height
+    )
+    {
+        LogDebug{"cover: bad thumbnail '{}'\n", aPath};
+        return nullptr;
+    }
+
+    AVFrame* pScaled = dll::av_frame_alloc();
+    pScaled->format = AV_PIX_FMT_RGB24;
+    pScaled->width = header.width;
+    pScaled->height = header.height;
+    if (dll::av_frame_get_buffer(pScaled, 0) < 0)
+    {
+        dll::av_frame_free(&pScaled);
+        return nullptr;
+    }
+
+    const u8* pRows = reinterpret_cast<const u8*>(sFile.data()) + sizeof(ThumbnailHeader);
+    for (int y = 0; y < pScaled->height; ++y)
+        utils::memCopy(pScaled->data[0] + isize(y)*pScaled->linesize[0], pRows + y*rowSize, rowSize);
+
+    /* Used ones stay, pruneThumbnails() goes by mtime. */
+    utimensat(AT_FDCWD, aPath, nullptr, 0);
+
+    return pScaled;
+}
+
+void
+CoverLoader::saveThumbnail(u64 hash, int targetWidth, int targetHeight, const AVFrame* pScaled)
+{
+    char aPath[1024] {};
+    const isize n = thumbnailPath(aPath, hash, targetWidth, targetHeight);
+    if (n <= 0) return;
+
+    /* Written aside and renamed, another instance never reads half of it. */
+    char aTmpPath[1040] {};
+    const isize nTmp = print::toBuffer(aTmpPath, sizeof(aTmpPath) - 1, "{}.tmp", StringView(aPath, n));
+    aTmpPath[nTmp] = '\0';
+
+    FILE* pf = fopen(aTmpPath, "wb");
+    if (!pf)
+    {
+        LogDebug{"cover: failed to open '{}': {}\n", aTmpPath, strerror(errno)};
+        return;
+    }
+
+    const ThumbnailHeader header {.magic = THUMBNAIL_MAGIC, .width = u32(pScaled->width), .height = u32(pScaled->height)};
+    bool bOk = fwrite(&header, sizeof(header), 1, pf) == 1;
+
+    const isize rowSize = isize(pScaled->width) * 3;
+    for (int y = 0; bOk && y < pScaled->height; ++y)
+        bOk = fwrite(pScaled->data[0] + isize(y)*pScaled->linesize[0], rowSize, 1, pf) == 1;
+
+    bOk = fclose(pf) == 0 && bOk;
+
+    if (!bOk || rename(aTmpPath, aPath) != 0)
+    {
+        LogDebug{"cover: failed to write '{}'\n", aPath};
+        unlink(aTmpPath);
+    }
+}
+
+void
+CoverLoader::pruneThumbnails()
+{
+    struct DiskThumbnail
+    {
+        i64 mtime {};
+        isize size {};
+        char aName[64] {};
+    };
+
+    VecManaged<DiskThumbnail> vFiles {};
+    defer( vFiles.destroy() );
+
+    isize nTotal = 0;
+    {
+        Directory dir {m_sDiskDir.data()};
+        if (!dir) return;
+        defer( dir.close() );
+
+        for (const StringView svName : dir)
+        {
+            if (!svName.endsWith(".rgb") || svName.size() >= isize(sizeof(DiskThumbnail::aName))) continue;
+
+            char aPath[1024] {};
+            const isize n = print::toBuffer(aPath, sizeof(aPath) - 1, "{}/{}", m_sDiskDir, svName);
+            aPath[n] = '\0';
+
+            struct stat st {};
+            if (stat(aPath, &st) != 0) continue;
+
+            DiskThumbnail file {.mtime = i64(st.st_mtime), .size = isize(st.st_size)};
+            utils::memCopy(file.aName, svName.data(), svName.size());
+            vFiles.push(file);
+            nTotal += file.size;
+        }
+    }
+
+    if (nTotal <= MAX_DISK_BYTES) return;
+
+    sort::quick(&vFiles, [](const DiskThumbnail& l, const DiskThumbnail& r) -> isize {
+        return l.mtime < r.mtime ? -1 : l.mtime > r.mtime ? 1 : 0;
+    });
+
+    isize nRemoved = 0;
+    for (const DiskThumbnail& file : vFiles)
+    {
+        if (nTotal <= MAX_DISK_BYTES) break;
+
+        char aPath[1024] {};
+        const isize n = print::toBuffer(aPath, sizeof(aPath) - 1, "{}/{}", m_sDiskDir, StringView {file.aName});
+        aPath[n] = '\0';
+
+        if (unlink(aPath) != 0) continue;
+
+        nTotal -= file.size;
+        ++nRemoved;
+    }
+
+    LogDebug{"cover: removed {} old thumbnails, {} bytes left\n", nRemoved, nTotal};
+}
+
+AVFrame*
+CoverLoader::decodeScaled(const Entry& job, int targetWidth, int targetHeight)
+{
+    const AVCodec* pCodec = dll::avcodec_find_decoder(job.eCodecId);
+    if (!pCodec) return nullptr;
+
+    AVCodecContext* pCodecCtx = dll::avcodec_alloc_context3(pCodec);
+    if (!pCodecCtx) return nullptr;
+    defer( dll::avcodec_free_context(&pCodecCtx) );
+
+    /* Jpeg decoder outputs 1/2, 1/4 or 1/8 of the size by itself, 3000x3000 scans aren't decoded whole. */
+    if (job.srcWidth > 0 && job.srcHeight > 0)
+    {
+        const f64 fit = utils::min(f64(targetWidth) / job.srcWidth, f64(targetHeight) / job.srcHeight);
+        int lowres = 0;
+        while (lowres < pCodec->max_lowres && f64(1 << (lowres + 1)) * fit <= 1.0) ++lowres;
+        pCodecCtx->lowres = lowres;
+    }
+
+    if (dll::avcodec_open2(pCodecCtx, pCodec, {}) < 0) return nullptr;
+
+    AVFrame* pFrame = dll::av_frame_alloc();
+    defer( dll::av_frame_free(&pFrame) );
+
+    if (dll::avcodec_send_packet(pCodecCtx, job.pPacket) < 0) return nullptr;
+    if (dll::avcodec_receive_frame(pCodecCtx, pFrame) == AVERROR(EAGAIN))
+    {
+        dll::avcodec_send_packet(pCodecCtx, nullptr);
+        if (dll::avcodec_receive_frame(pCodecCtx, pFrame) < 0) return nullptr;
+    }
+
+    if (pFrame->width <= 0 || pFrame->height <= 0) return nullptr;
+
+    /* Fit into the target, never upscaled. */
+    const f64 scale = utils::min(1.0, utils::min(f64(targetWidth) / pFrame->width, f64(targetHeight) / pFrame->height));
+    const int width = utils::max(int(pFrame->width * scale), 1);
+    const int height = utils::max(int(pFrame->height * scale), 1);
+
+    AVFrame* pScaled = dll::av_frame_alloc();
+    pScaled->format = AV_PIX_FMT_RGB24;
+    pScaled->width = width;
+    pScaled->height = height;
+
+    /* Area averaging: cheap, and doesn't alias on big reductions like the bilinear ones. */
+    SwsContext* pSwsCtx = dll::sws_getContext(
+        pFrame->width, pFrame->height, AVPixelFormat(pFrame->format),
+        width, height, AV_PIX_FMT_RGB24,
+        SWS_AREA,
+        {}, {}, {}
+    );
+    defer( if (pSwsCtx) dll::sws_freeContext(pSwsCtx) );
+
+    if (!pSwsCtx ||
+        dll::av_frame_get_buffer(pScaled, 0) < 0 ||
+        dll::sws_scale_frame(pSwsCtx, pScaled, pFrame) < 0
+    )
+    {
+        dll::av_frame_free(&pScaled);
+        return nullptr;
+    }
+
+    return pScaled;
+}
+
+} /* namespace platform::ffmpeg */
+
+#endif
@@ -0,0 +1,94 @@
+#pragma once
+
+#ifdef OPT_CHAFA
+
+#include "Image.hh"
+
+extern "C"
+{
+
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+
+}
+
+namespace platform::ffmpeg
+{
+
+/* Decodes and downscales attached pictures on its own thread, opening a song only references the packet.
+ * Pictures are scaled to fit the target pixel size (set by the ui), redone when it changes.
+ * Keeps the last MAX_CACHED by path (current and preopened next song), the latest request is done first. Paths must outlive the loader.
+ * Scaled pictures are also kept on disk by the hash of the packet, songs of one album share them and skip the decode.
+ * Target sizes are rounded up to TARGET_STEP so resizes reuse them, the oldest files go when they're over MAX_DISK_BYTES.
+ * Songs without an attached picture use cover.jpg, folder.png etc. from their directory, each directory is looked at once. */
+struct CoverLoader
+{
+    static constexpr isize MAX_CACHED = 4;
+    static constexpr u32 THUMBNAIL_MAGIC = 0x4350'4d4b; /* "KMPC" */
+    static constexpr int TARGET_STEP = 128; /* Pixels. */
+    static constexpr isize MAX_DISK_BYTES = SIZE_1M * 64; /* Checked once when the thread starts. */
+
+    struct ThumbnailHeader
+    {
+        u32 magic {};
+        u32 width {};
+        u32 height {}; /* Packed RGB24 rows follow. */
+    };
+
+    struct Entry
+    {
+        StringView svPath {};
+        AVPacket* pPacket {}; /* Reference to the stream's attached_pic, or the folder picture once it's read. */
+        AVCodecID eCodecId {};
+        u64 hash {}; /* xxh64 of the packet data. */
+        int srcWidth {}; /* From codecpar, 0 if unknown. */
+        int srcHeight {};
+        AVFrame* pScaled {}; /* RGB24, nullptr until it's ready. */
+        int targetWidth {}; /* pScaled was made for. */
+        int targetHeight {};
+        bool bFolder {}; /* Picture comes from the song's directory. */
+        bool bFailed {};
+    };
+
+    Mutex m_mtx {};
+    CndVar m_cnd {};
+    Thread m_thrd {};
+    Entry m_aEntries[MAX_CACHED] {};
+    isize m_nextEntryI {}; /* Oldest one gets replaced. */
+    String m_sDiskDir {}; /* Empty if thumbnails aren't kept. */
+    Map<StringView, String> m_mFolderPictures {}; /* Directory to its picture path, empty if it has none. Loader thread only. */
+    int m_targetWidth = 512;
+    int m_targetHeight = 512;
+    atomic::Int m_atom_nPublished {}; /* Bumped for every finished picture, ui redraws when it changes. */
+    atomic::Bool m_atom_bQuit {false};
+    bool m_bStarted = false;
+
+    /* */
+
+    void start(StringView svCacheDir); /* Thumbnails go to svCacheDir/covers, nowhere if empty. */
+    void destroy() noexcept;
+    void request(StringView svPath, const AVStream* pStream); /* Stream with AV_DISPOSITION_ATTACHED_PIC. */
+    void requestFolder(StringView svPath); /* Song without one. */
+    void setTargetSize(int width, int height); /* Pixels, rounded up to TARGET_STEP. */
+    [[nodiscard]] bool hasCover(StringView svPath); /* Even if it's not decoded yet, folder pictures once they're found. */
+    [[nodiscard]] bool coverSize(StringView svPath, int* pWidth, int* pHeight); /* Of the picture copyCover() would return, false until it's ready. */
+    [[nodiscard]] Image copyCover(IAllocator* pAlloc, StringView svPath); /* Packed RGB8, empty until it's ready. */
+
+protected:
+    THREAD_STATUS loop();
+    [[nodiscard]] Entry* search(StringView svPath); /* m_mtx must be locked. */
+    [[nodiscard]] Entry* nextJob(); /* m_mtx must be locked. */
+    void readFolderPicture(StringView svPath); /* Thread only, without m_mtx. */
+    [[nodiscard]] StringView findFolderPicture(StringView svDir); /* Memoized directory probe, empty if there's none. */
+    [[nodiscard]] bool shareScaled(Entry* pJob); /* Same picture is already scaled for another song, m_mtx must be locked. */
+    [[nodiscard]] AVFrame* loadThumbnail(u64 hash, int targetWidth, int targetHeight);
+    void saveThumbnail(u64 hash, int targetWidth, int targetHeight, const AVFrame* pScaled);
+    void pruneThumbnails(); /* Least recently used first, by mtime. */
+    isize thumbnailPath(Span<char> spBuff, u64 hash, int targetWidth, int targetHeight); /* Null terminated, 0 if disabled. */
+    [[nodiscard]] AVFrame* decodeScaled(const Entry& job, int targetWidth, int targetHeight); /* Thread only, without m_mtx. */
+    static void freeEntry(Entry* pEntry) noexcept;
+};
+
+} /* namespace platform::ffmpeg */
+
+#endif
@@ -1,58 +1,79 @@
 #include "Decoder.hh"
 #include "dll.hh"
 
-extern "C"
-{
-
-#include <libavutil/imgutils.h>
-
-}
+#include <sys/stat.h>
 
 namespace platform::ffmpeg
 {
 
-[[maybe_unused]] static IMAGE_PIXEL_FORMAT
-covertFormat(int format)
-{
-    switch (format)
-    {
-        default: return IMAGE_PIXEL_FORMAT::NONE;
-
-        case AV_PIX_FMT_RGB24: return IMAGE_PIXEL_FORMAT::RGB8;
-
-        case AV_PIX_FMT_RGBA: return IMAGE_PIXEL_FORMAT::RGBA8_UNASSOCIATED;
-    }
-};
+constexpr f64 SEEK_PREROLL_MS = 100.0; /* Indexed seeks start this much earlier, mp3 bit reservoir reaches a few frames back. */
 
 void
 Decoder::close()
 {
     if (m_pFormatCtx) dll::avformat_close_input(&m_pFormatCtx);
+    if (m_pIO)
+    {
+        /* Custom IO isn't closed by avformat_close_input(). */
+        m_pIO->close();
+        Gpa::inst()->free(m_pIO);
+        m_pIO = {};
+    }
     if (m_pCodecCtx) dll::avcodec_free_context(&m_pCodecCtx);
     if (m_pSwr) dll::swr_free(&m_pSwr);
-    if (m_pImgPacket) dll::av_packet_free(&m_pImgPacket);
-    if (m_pImgFrame) dll::av_frame_free(&m_pImgFrame);
 
     if (m_pTmpPacket) dll::av_packet_free(&m_pTmpPacket);
     if (m_pTmpFrame) dll::av_frame_free(&m_pTmpFrame);
     if (m_pCvtFrame) dll::av_frame_free(&m_pCvtFrame);
 
-#ifdef OPT_CHAFA
-    if (m_pConverted) dll::av_frame_free(&m_pConverted);
-    if (m_pSwsCtx) dll::sws_freeContext(m_pSwsCtx), m_pSwsCtx = {};
-#endif
-
     m_pStream = {};
     m_audioStreamIdx = {};
     m_currentSamplePos = {};
     m_currentMS = {};
-    m_coverImg = {};
+    m_svPath = {};
+    m_framePos = {};
+    m_skipToFrame = -1;
+    m_endFrame = -1;
+    m_bNeedsIndex = false;
+    m_cvtOffset = {};
+    m_swrInFormat = m_swrOutFormat = -1;
+    m_eOutPcmType = audio::PCM_TYPE::F32;
 
     /* WARN: don't zero out m_mtx! */
 
     LogDebug("close()\n");
 }
 
+void
+Decoder::swap(Decoder* pOther) noexcept
+{
+    /* WARN: keep in sync with the fields. */
+    utils::swap(&m_pStream, &pOther->m_pStream);
+    utils::swap(&m_pFormatCtx, &pOther->m_pFormatCtx);
+    utils::swap(&m_pIO, &pOther->m_pIO);
+    utils::swap(&m_pCodecCtx, &pOther->m_pCodecCtx);
+    utils::swap(&m_pSwr, &pOther->m_pSwr);
+    utils::swap(&m_audioStreamIdx, &pOther->m_audioStreamIdx);
+    utils::swap(&m_currentSamplePos, &pOther->m_currentSamplePos);
+    utils::swap(&m_currentMS, &pOther->m_currentMS);
+    utils::swap(&m_svPath, &pOther->m_svPath);
+    utils::swap(&m_framePos, &pOther->m_framePos);
+    utils::swap(&m_skipToFrame, &pOther->m_skipToFrame);
+    utils::swap(&m_endFrame, &pOther->m_endFrame);
+    utils::swap(&m_bNeedsIndex, &pOther->m_bNeedsIndex);
+
+    utils::swap(&m_pTmpPacket, &pOther->m_pTmpPacket);
+    utils::swap(&m_pTmpFrame, &pOther->m_pTmpFrame);
+    utils::swap(&m_pCvtFrame, &pOther->m_pCvtFrame);
+    utils::swap(&m_cvtOffset, &pOther->m_cvtOffset);
+    utils::swap(&m_swrInFormat, &pOther->m_swrInFormat);
+    utils::swap(&m_swrOutFormat, &pOther->m_swrOutFormat);
+    utils::swap(&m_eOutPcmType, &pOther->m_eOutPcmType);
+
+    /* Preloaded song plays now, its index shouldn't wait behind the previous one's. */
+    if (m_bNeedsIndex && !m_bPreloads) m_pSeekIndexer->request(m_svPath, false);
+}
+
 Decoder&
 Decoder::init()
 {
@@ -88,7 +109,7 @@ Decoder::getTotalMS()
     int nChannels = getChannelsCount();
 
     if (sr == 0 || nChannels == 0) return 0;
-    else return (totalCount / sr / nChannels) * 1000;
+    else return totalCount * 1000 / (i64(sr) * nChannels);
 }
 
 
@@ -117,96 +138,38 @@ Decoder::getMetadata(const StringView svKey)
 
 #ifdef OPT_CHAFA
 void
-Decoder::getAttachedPicture()
+Decoder::requestCover()
 {
-    int err = 0;
-    AVStream* pStream {};
+    if (!m_pCoverLoader) return;
 
     for (int i = 0; i < (int)m_pFormatCtx->nb_streams; ++i)
     {
-        auto* itStream = m_pFormatCtx->streams[i];
-        if (itStream->disposition & AV_DISPOSITION_ATTACHED_PIC)
+        const AVStream* pStream = m_pFormatCtx->streams[i];
+        if (pStream->disposition & AV_DISPOSITION_ATTACHED_PIC)
         {
             LogDebug("Found 'attached_pic'\n");
-            pStream = itStream;
-            break;
+            m_pCoverLoader->request(m_svPath, pStream);
+            return;
         }
     }
 
-    if (!pStream) return;
-
-    const AVCodec* pCodec = dll::avcodec_find_decoder(pStream->codecpar->codec_id);
-    if (!pCodec) return;
-
-    auto* pCodecCtx = dll::avcodec_alloc_context3(pCodec);
-    if (!pCodecCtx) return;
-    defer( dll::avcodec_free_context(&pCodecCtx) );
-
-    dll::avcodec_parameters_to_context(pCodecCtx, pStream->codecpar);
-    err = dll::avcodec_open2(pCodecCtx, pCodec, {});
-    if (err < 0)
-    {
-        LogDebug("avcodec_open2()\n");
-        return;
-    }
-
-    LogDebug("codec name: '{}'\n", pCodec->long_name);
-
-    m_pImgPacket = dll::av_packet_alloc();
-    err = dll::av_read_frame(m_pFormatCtx, m_pImgPacket);
-    if (err != 0) return;
-
-    err = dll::avcodec_send_packet(pCodecCtx, m_pImgPacket);
-    if (err != 0) return;
-
-    m_pImgFrame = dll::av_frame_alloc();
-    err = dll::avcodec_receive_frame(pCodecCtx, m_pImgFrame);
-    if (err == AVERROR(EINVAL))
-    {
-        LogDebug("err: {}, AVERROR(EINVAL)\n", err);
-        return;
-    }
-
-    m_pSwsCtx = dll::sws_getContext(
-        m_pImgFrame->width, m_pImgFrame->height, (AVPixelFormat)m_pImgFrame->format,
-        m_pImgFrame->width, m_pImgFrame->height, AV_PIX_FMT_RGB24,
-        SWS_LANCZOS,
-        {}, {}, {}
-    );
-
-    m_pConverted = dll::av_frame_alloc();
-    dll::av_image_fill_linesizes(m_pConverted->linesize, AV_PIX_FMT_RGB24, m_pImgFrame->width);
-
-    m_pConverted->format = AV_PIX_FMT_RGB24;
-    m_pConverted->width = m_pImgFrame->width;
-    m_pConverted->height = m_pImgFrame->height;
-
-    LogDebug("format: {}, converted format: {}\n", m_pImgFrame->format, m_pConverted->format);
-
-    err = dll::av_frame_get_buffer(m_pConverted, 0);
-    if (err != 0)
-    {
-        LogDebug("av_frame_get_buffer()\n");
-        return;
-    }
-
-    dll::sws_scale_frame(m_pSwsCtx, m_pConverted, m_pImgFrame);
-
-    m_coverImg = Image {
-        .pBuff = m_pConverted->data[0],
-        .width = m_pConverted->width,
-        .height = m_pConverted->height,
-        .eFormat = covertFormat(m_pConverted->format)
-    };
+    m_pCoverLoader->requestFolder(m_svPath);
 }
 #else
-    #define getAttachedPicture(...) (void)0
+    #define requestCover(...) (void)0
 #endif
 
-Image
-Decoder::getCoverImage()
+/* Cached stream still looks the same after avformat_open_input(), so probing would find what it found before. */
+static bool
+headerMatches(const AVFormatContext* pFormatCtx, const StreamInfo& info)
 {
-    return m_coverImg;
+    if (info.streamIdx < 0 || info.streamIdx >= int(pFormatCtx->nb_streams)) return false;
+
+    const AVCodecParameters* pPar = pFormatCtx->streams[info.streamIdx]->codecpar;
+    return pPar->codec_type == AVMEDIA_TYPE_AUDIO &&
+        pPar->codec_id == info.codecId &&
+        pPar->sample_rate > 0 && pPar->sample_rate == info.sampleRate &&
+        pPar->ch_layout.nb_channels > 0 && pPar->ch_layout.nb_channels == info.nChannels;
 }
 
 audio::ERROR
@@ -220,18 +183,70 @@ Decoder::open(StringView svPath)
     int err = 0;
     defer( if (err < 0) close() );
 
+    /* Local files are read through the mapping, the path is still used for probing. */
+    m_pIO = Gpa::inst()->alloc<MappedIO>();
+    if (m_pIO->open(sPathNullTerm.data()) && (m_pFormatCtx = dll::avformat_alloc_context()))
+    {
+        m_pFormatCtx->pb = m_pIO->m_pAvio;
+        m_pFormatCtx->flags |= AVFMT_FLAG_CUSTOM_IO;
+    }
+    else
+    {
+        m_pIO->close();
+        Gpa::inst()->free(m_pIO);
+        m_pIO = {};
+    }
+
     err = dll::avformat_open_input(&m_pFormatCtx, sPathNullTerm.data(), {}, {});
     if (err != 0) return audio::ERROR::FAIL;
 
-    err = dll::avformat_find_stream_info(m_pFormatCtx, {});
-    if (err != 0) return audio::ERROR::FAIL;
+    struct stat st {};
+    StreamInfo info {};
+    const bool bStat = m_pInfoCache && stat(sPathNullTerm.data(), &st) == 0;
+    const bool bKnown = bStat && m_pInfoCache->find(svPath, st.st_size, st.st_mtime, &info);
+
+    int idx = -1;
+    if (bKnown && headerMatches(m_pFormatCtx, info))
+    {
+        /* Skip probing, it would only confirm the header and recompute the duration. */
+        idx = info.streamIdx;
+        m_pFormatCtx->duration = info.duration;
+        m_pFormatCtx->duration_estimation_method = AVDurationEstimationMethod(info.eDurationMethod);
+    }
+    else
+    {
+        /* Header is missing something, but the audio stream got found quickly before. */
+        if (bKnown) m_pFormatCtx->max_analyze_duration = AV_TIME_BASE / 2;
+
+        err = dll::avformat_find_stream_info(m_pFormatCtx, {});
+        if (err != 0) return audio::ERROR::FAIL;
 
-    int idx = dll::av_find_best_stream(m_pFormatCtx, AVMEDIA_TYPE_AUDIO, -1, -1, {}, 0);
-    if (idx < 0) return audio::ERROR::FAIL;
+        idx = dll::av_find_best_stream(m_pFormatCtx, AVMEDIA_TYPE_AUDIO, -1, -1, {}, 0);
+        if (idx < 0) return audio::ERROR::FAIL;
+
+        if (bStat)
+        {
+            const AVCodecParameters* pPar = m_pFormatCtx->streams[idx]->codecpar;
+            m_pInfoCache->add(svPath, {
+                .size = i64(st.st_size),
+                .mtime = i64(st.st_mtime),
+                .streamIdx = idx,
+                .codecId = pPar->codec_id,
+                .sampleRate = pPar->sample_rate,
+                .nChannels = pPar->ch_layout.nb_channels,
+                .duration = m_pFormatCtx->duration,
+                .eDurationMethod = m_pFormatCtx->duration_estimation_method,
+            });
+        }
+    }
 
     m_audioStreamIdx = idx;
     m_pStream = m_pFormatCtx->streams[idx];
 
+    /* Video, subtitles and other audio tracks don't even get read (videos played as audio), attached picture is already in its AVStream. */
+    for (int i = 0; i < int(m_pFormatCtx->nb_streams); ++i)
+        if (i != idx) m_pFormatCtx->streams[i]->discard = AVDISCARD_ALL;
+
     const AVCodec* pCodec = dll::avcodec_find_decoder(m_pStream->codecpar->codec_id);
     if (!pCodec) return audio::ERROR::FAIL;
 
@@ -257,7 +272,10 @@ Decoder::open(StringView svPath)
         pCodec->long_name, m_pStream->codecpar->ch_layout.nb_channels, m_pStream->codecpar->bit_rate, m_pStream->codecpar->sample_rate
     );
 
-    getAttachedPicture();
+    m_svPath = svPath;
+    if (!m_bNoCover) requestCover();
+    m_bNeedsIndex = m_pSeekIndexer && m_pFormatCtx->duration_estimation_method == AVFMT_DURATION_FROM_BITRATE;
+    if (m_bNeedsIndex) m_pSeekIndexer->request(svPath, m_bPreloads);
 
     m_pTmpPacket = dll::av_packet_alloc();
     m_pTmpFrame = dll::av_frame_alloc();
@@ -267,74 +285,242 @@ Decoder::open(StringView svPath)
 }
 
 audio::ERROR
-Decoder::writeToRingBuffer(
-    audio::RingBuffer* pRingBuff,
-    [[maybe_unused]] const int nChannels,
-    [[maybe_unused]] const audio::PCM_TYPE ePcmType,
-    long* pSamplesWritten,
-    isize* pPcmPos
-)
+Decoder::receiveFrame()
 {
-    if (!m_pStream) return audio::ERROR::END_OF_FILE;
-
     int err = 0;
-    long nWrites = 0;
+    while ((err = dll::avcodec_receive_frame(m_pCodecCtx, m_pTmpFrame)) == AVERROR(EAGAIN))
+    {
+        AVPacket* pPacket = m_pTmpPacket;
+        while (true)
+        {
+            if (dll::av_read_frame(m_pFormatCtx, pPacket) != 0)
+            {
+                /* Drain whatever the codec still buffers, receive_frame() returns AVERROR_EOF after that. */
+                dll::avcodec_send_packet(m_pCodecCtx, nullptr);
+                break;
+            }
+
+            defer( dll::av_packet_unref(pPacket) );
+
+            if (pPacket->stream_index != m_pStream->index) continue;
 
-    *pSamplesWritten = 0;
+            err = dll::avcodec_send_packet(m_pCodecCtx, pPacket);
+            if (err != 0 && err != AVERROR(EAGAIN))
+                LogWarn("!EAGAIN\n");
 
-    AVPacket* pPacket = m_pTmpPacket;
-    while (dll::av_read_frame(m_pFormatCtx, pPacket) == 0)
+            break;
+        }
+    }
+
+    if (err != 0) return audio::ERROR::END_OF_FILE;
+
+    /* Timestamps of the files without an exact duration are estimates too, so the position is counted.
+     * Only the first frame after a seek without the index takes it from the timestamp. */
+    AVFrame* pFrame = m_pTmpFrame;
+    if (m_framePos < 0)
     {
-        defer( dll::av_packet_unref(pPacket) );
+        const i64 ts = pFrame->best_effort_timestamp;
+        m_framePos = ts != AV_NOPTS_VALUE ?
+            dll::av_rescale_q(ts, m_pStream->time_base, AVRational{1, pFrame->sample_rate}) :
+            utils::max(m_skipToFrame, i64(0));
+    }
 
-        if (pPacket->stream_index != m_pStream->index) continue;
+    m_framePos += pFrame->nb_samples;
+    m_currentMS = f64(m_framePos) * 1000.0 / f64(pFrame->sample_rate);
+    m_currentSamplePos = m_framePos * pFrame->ch_layout.nb_channels;
 
-        err = dll::avcodec_send_packet(m_pCodecCtx, pPacket);
-        if (err != 0 && err != AVERROR(EAGAIN))
-            LogWarn("!EAGAIN\n");
+    return audio::ERROR::OK_;
+}
 
-        AVFrame* pFrame = m_pTmpFrame;
-        while ((err = dll::avcodec_receive_frame(m_pCodecCtx, pFrame)) == 0)
-        {
-            defer( dll::av_frame_unref(pFrame) );
+static AVSampleFormat
+sampleFormat(audio::PCM_TYPE e)
+{
+    switch (e)
+    {
+        case audio::PCM_TYPE::S16: return AV_SAMPLE_FMT_S16;
+        case audio::PCM_TYPE::S32: return AV_SAMPLE_FMT_S32;
+        case audio::PCM_TYPE::F32: return AV_SAMPLE_FMT_FLT;
+    }
+
+    return AV_SAMPLE_FMT_FLT;
+}
 
-            f64 currentTimeInSeconds = av_q2d(m_pStream->time_base) * (pFrame->best_effort_timestamp + pFrame->nb_samples);
-            m_currentMS = currentTimeInSeconds * 1000.0;
-            long pcmPos = currentTimeInSeconds * pFrame->ch_layout.nb_channels * pFrame->sample_rate;
-            m_currentSamplePos = pcmPos;
-            *pPcmPos = pcmPos;
+bool
+Decoder::configureSwr(AVSampleFormat eOut)
+{
+    const AVFrame* pFrame = m_pTmpFrame;
+    if (pFrame->format == m_swrInFormat && eOut == m_swrOutFormat) return true;
 
-            /* NOTE: not changing sample rate here, but on the mixer side instead. */
-            AVFrame* pRes = m_pCvtFrame;
-            pRes->sample_rate = pFrame->sample_rate;
-            pRes->ch_layout = pFrame->ch_layout;
-            pRes->format = AV_SAMPLE_FMT_FLT;
+    /* Only the parameters of m_pCvtFrame are used, it's empty between conversions. */
+    AVFrame* pRes = m_pCvtFrame;
+    pRes->sample_rate = pFrame->sample_rate;
+    pRes->ch_layout = pFrame->ch_layout;
+    pRes->format = eOut;
 
-            dll::swr_config_frame(m_pSwr, pRes, pFrame);
-            err = dll::swr_convert_frame(m_pSwr, pRes, pFrame);
-            defer( dll::av_frame_unref(pRes) );
+    m_swrInFormat = m_swrOutFormat = -1;
+    int err = dll::swr_config_frame(m_pSwr, pRes, pFrame);
+    if (err >= 0) err = dll::swr_init(m_pSwr);
 
-            if (err < 0)
-            {
-                char aBuff[AV_ERROR_MAX_STRING_SIZE] {};
-                const int n = dll::av_strerror(err, aBuff, sizeof(aBuff));
-                LogError("swr_convert_frame(): {}\n", Span{aBuff, n});
-                continue;
-            }
+    if (err < 0)
+    {
+        char aBuff[AV_ERROR_MAX_STRING_SIZE] {};
+        const int n = dll::av_strerror(err, aBuff, sizeof(aBuff));
+        LogError("swr_init(): {}\n", Span{aBuff, n});
+        return false;
+    }
+
+    m_swrInFormat = pFrame->format;
+    m_swrOutFormat = eOut;
+    return true;
+}
+
+isize
+Decoder::convertFrameInto(void* pDst, isize nMaxBytes)
+{
+    const AVFrame* pFrame = m_pTmpFrame;
+    const AVSampleFormat eFormat = sampleFormat(m_eOutPcmType);
+    const isize nBytes = isize(pFrame->nb_samples) * pFrame->ch_layout.nb_channels * audio::pcmTypeSize(m_eOutPcmType);
+
+    /* Trimming after seeks and the referenced frames go through m_pCvtFrame. */
+    if (m_skipToFrame >= 0 || pFrame->format == eFormat || nBytes > nMaxBytes) return 0;
+    if (!configureSwr(eFormat)) return 0;
+
+    u8* p = static_cast<u8*>(pDst);
+    const int n = dll::swr_convert(m_pSwr, &p, pFrame->nb_samples, pFrame->extended_data, pFrame->nb_samples);
+    if (n < 0) return 0;
+
+    return isize(n) * pFrame->ch_layout.nb_channels * audio::pcmTypeSize(m_eOutPcmType);
+}
+
+bool
+Decoder::convertFrame()
+{
+    /* NOTE: not changing sample rate here, but on the mixer side instead. */
+    AVFrame* pFrame = m_pTmpFrame;
+    AVFrame* pRes = m_pCvtFrame;
+    const AVSampleFormat eFormat = sampleFormat(m_eOutPcmType);
+    m_cvtOffset = 0;
+
+    /* Already interleaved in the right format (S16/S32 wav, flac...), no need to copy it. */
+    if (pFrame->format == eFormat) return dll::av_frame_ref(pRes, pFrame) >= 0;
+
+    if (!configureSwr(eFormat)) return false;
+
+    const int err = dll::swr_convert_frame(m_pSwr, pRes, pFrame);
+
+    if (err < 0)
+    {
+        dll::av_frame_unref(pRes);
+
+        char aBuff[AV_ERROR_MAX_STRING_SIZE] {};
+        const int n = dll::av_strerror(err, aBuff, sizeof(aBuff));
+        LogError("swr_convert_frame(): {}\n", Span{aBuff, n});
+        return false;
+    }
+
+    return true;
+}
+
+Span<const u8>
+Decoder::pendingBytes() const
+{
+    const isize n = isize(m_pCvtFrame->nb_samples) * m_pCvtFrame->ch_layout.nb_channels * audio::pcmTypeSize(m_eOutPcmType);
+    if (n <= m_cvtOffset) return {};
+
+    return {m_pCvtFrame->data[0] + m_cvtOffset, n - m_cvtOffset};
+}
+
+void
+Decoder::trimConverted()
+{
+    if (m_skipToFrame < 0) return;
 
-            const int nFrameSamples = pRes->nb_samples * pRes->ch_layout.nb_channels;
-            const isize ringSize = pRingBuff->push(Span{reinterpret_cast<f32*>(pRes->data[0]), nFrameSamples});
-            nWrites += nFrameSamples;
+    const i64 nFrames = m_pCvtFrame->nb_samples;
+    const i64 nSkip = utils::clamp(m_skipToFrame - (m_framePos - nFrames), i64(0), nFrames);
+    m_cvtOffset = nSkip * m_pCvtFrame->ch_layout.nb_channels * audio::pcmTypeSize(m_eOutPcmType);
 
-            if (ringSize >= audio::RING_BUFFER_HIGH_THRESHOLD)
+    if (m_framePos >= m_skipToFrame) m_skipToFrame = -1;
+}
+
+audio::PCM_TYPE
+Decoder::getNativePcmType()
+{
+    if (!m_pCodecCtx) return audio::PCM_TYPE::F32;
+
+    switch (m_pCodecCtx->sample_fmt)
+    {
+        default: return audio::PCM_TYPE::F32;
+
+        case AV_SAMPLE_FMT_U8:
+        case AV_SAMPLE_FMT_U8P:
+        case AV_SAMPLE_FMT_S16:
+        case AV_SAMPLE_FMT_S16P:
+                 return audio::PCM_TYPE::S16;
+
+        case AV_SAMPLE_FMT_S32:
+        case AV_SAMPLE_FMT_S32P:
+                 return audio::PCM_TYPE::S32;
+    }
+}
+
+void
+Decoder::setOutputPcmType(audio::PCM_TYPE e)
+{
+    if (e == m_eOutPcmType) return;
+
+    /* Converted leftovers are in the old format. */
+    if (m_pCvtFrame) dll::av_frame_unref(m_pCvtFrame);
+    m_cvtOffset = 0;
+    m_eOutPcmType = e;
+}
+
+audio::ERROR
+Decoder::readSamples(Span<f32> sp, isize* pnRead)
+{
+    ADT_ASSERT(m_eOutPcmType == audio::PCM_TYPE::F32, "m_eOutPcmType: {}", int(m_eOutPcmType));
+    return readRaw(sp.data(), sp.size(), pnRead);
+}
+
+audio::ERROR
+Decoder::readRaw(void* pDst, isize nSamples, isize* pnRead)
+{
+    const isize sampleSize = audio::pcmTypeSize(m_eOutPcmType);
+    const isize nBytes = nSamples * sampleSize;
+    u8* p = static_cast<u8*>(pDst);
+    isize nRead = 0; /* Bytes. */
+    defer( *pnRead = nRead / sampleSize );
+
+    if (!m_pStream) return audio::ERROR::END_OF_FILE;
+
+    while (nRead < nBytes)
+    {
+        Span<const u8> spPending = pendingBytes();
+        if (!spPending)
+        {
+            dll::av_frame_unref(m_pCvtFrame);
+
+            if (receiveFrame() != audio::ERROR::OK_) return audio::ERROR::END_OF_FILE;
+            defer( dll::av_frame_unref(m_pTmpFrame) );
+
+            /* Whole frame fits, swr writes straight into pDst. */
+            if (const isize n = convertFrameInto(p + nRead, nBytes - nRead))
             {
-                *pSamplesWritten = nWrites;
-                return audio::ERROR::OK_;
+                nRead += n;
+                continue;
             }
+
+            if (!convertFrame()) continue;
+            trimConverted();
+            spPending = pendingBytes();
         }
+
+        const isize n = utils::min(spPending.size(), nBytes - nRead);
+        utils::memCopy(p + nRead, spPending.data(), n);
+        nRead += n;
+        m_cvtOffset += n;
     }
 
-    return audio::ERROR::END_OF_FILE;
+    return audio::ERROR::OK_;
 }
 
 u32
@@ -351,8 +537,30 @@ Decoder::seekMS(f64 ms)
     if (!m_pCodecCtx) return;
 
     dll::avcodec_flush_buffers(m_pCodecCtx);
-    i64 pts = dll::av_rescale_q(f64(ms) / 1000.0 * AV_TIME_BASE, AV_TIME_BASE_Q, m_pStream->time_base);
-    dll::av_seek_frame(m_pFormatCtx, m_audioStreamIdx, pts, 0);
+    dll::av_frame_unref(m_pCvtFrame);
+    m_cvtOffset = 0;
+
+    const u32 sr = getSampleRate();
+    const i64 targetFrame = i64(ms / 1000.0 * sr);
+    SeekIndex::Point point {};
+
+    /* Byte offset of a packet with a known frame, then decode up to the target. */
+    if (m_bNeedsIndex &&
+        m_pSeekIndexer->findPoint(m_svPath, targetFrame - i64(SEEK_PREROLL_MS / 1000.0 * sr), &point) &&
+        dll::av_seek_frame(m_pFormatCtx, m_audioStreamIdx, point.pos, AVSEEK_FLAG_BYTE) >= 0
+    )
+    {
+        m_framePos = point.frame;
+    }
+    else
+    {
+        /* Backward, so the trimming can reach the target. */
+        i64 pts = dll::av_rescale_q(f64(ms) / 1000.0 * AV_TIME_BASE, AV_TIME_BASE_Q, m_pStream->time_base);
+        dll::av_seek_frame(m_pFormatCtx, m_audioStreamIdx, pts, AVSEEK_FLAG_BACKWARD);
+        m_framePos = -1;
+    }
+
+    m_skipToFrame = targetFrame;
 }
 
 i64
@@ -366,6 +574,9 @@ Decoder::getTotalSamplesCount()
 {
     if (!m_pFormatCtx || !m_pStream) return {};
 
+    if (m_bNeedsIndex && m_endFrame < 0) (void)m_pSeekIndexer->findEndFrame(m_svPath, &m_endFrame);
+    if (m_endFrame >= 0) return m_endFrame * m_pStream->codecpar->ch_layout.nb_channels;
+
     i64 res = (m_pFormatCtx->duration / (f64)AV_TIME_BASE) * m_pStream->codecpar->sample_rate * m_pStream->codecpar->ch_layout.nb_channels;
     return res;
 }
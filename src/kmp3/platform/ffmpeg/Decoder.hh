@@ -1,7 +1,10 @@
 #pragma once
 
 #include "audio.hh"
-#include "Image.hh"
+#include "CoverLoader.hh"
+#include "MappedIO.hh"
+#include "SeekIndex.hh"
+#include "StreamInfo.hh"
 
 extern "C"
 {
@@ -10,10 +13,6 @@ extern "C"
 #include <libavformat/avformat.h>
 #include <libswresample/swresample.h>
 
-#ifdef OPT_CHAFA
-#include <libswscale/swscale.h>
-#endif
-
 }
 
 namespace platform::ffmpeg
@@ -21,14 +20,10 @@ namespace platform::ffmpeg
 
 struct Decoder : audio::IDecoder
 {
-    [[nodiscard]] virtual audio::ERROR writeToRingBuffer(
-        audio::RingBuffer* pRingBuff,
-        const int nChannels,
-        const audio::PCM_TYPE ePcmType,
-        long* pSamplesWritten,
-        isize* pPcmPos
-    ) override final;
-
+    [[nodiscard]] virtual audio::ERROR readSamples(Span<f32> sp, isize* pnRead) override final;
+    [[nodiscard]] virtual audio::ERROR readRaw(void* pDst, isize nSamples, isize* pnRead) override final;
+    [[nodiscard]] virtual audio::PCM_TYPE getNativePcmType() override final;
+    virtual void setOutputPcmType(audio::PCM_TYPE e) override final;
     virtual Decoder& init() noexcept(false) override final; /* RuntimeException */
     virtual void destroy() override final;
     [[nodiscard]] virtual u32 getSampleRate() override final;
@@ -39,7 +34,6 @@ struct Decoder : audio::IDecoder
     [[nodiscard]] virtual i64 getTotalSamplesCount() override final;
     [[nodiscard]] virtual int getChannelsCount() override final;
     [[nodiscard]] virtual StringView getMetadata(const StringView svKey) override final;
-    [[nodiscard]] virtual Image getCoverImage() override final;
     [[nodiscard]] virtual audio::ERROR open(StringView sPath) override final;
     virtual void close() override final;
 
@@ -47,29 +41,44 @@ struct Decoder : audio::IDecoder
 
     AVStream* m_pStream {};
     AVFormatContext* m_pFormatCtx {};
+    MappedIO* m_pIO {}; /* nullptr if ffmpeg opened the file itself. */
     AVCodecContext* m_pCodecCtx {};
     SwrContext* m_pSwr {};
     int m_audioStreamIdx {};
     u64 m_currentSamplePos {};
     f64 m_currentMS {};
-
-    AVPacket* m_pImgPacket {};
-    AVFrame* m_pImgFrame {};
-    Image m_coverImg {};
+    StringView m_svPath {};
+    i64 m_framePos {}; /* End of the last decoded frame, counted, not taken from timestamps. -1 until the first frame after a timestamp seek. */
+    i64 m_skipToFrame = -1; /* Decoded frames before this are dropped, seeks land exactly. */
+    i64 m_endFrame = -1; /* Exact length from the seek index. */
+    bool m_bNeedsIndex = false; /* Duration is only estimated from the bitrate. */
+    SeekIndexer* m_pSeekIndexer {}; /* Set by the app (Config::bSeekIndex), not swapped. */
+    bool m_bPreloads = false; /* Set by the app for nextDecoder(), not swapped. Its seek indexes wait behind the playing song's. */
+    StreamInfoCache* m_pInfoCache {}; /* Set by the app (Config::bStreamInfoCache), not swapped. */
 
 #ifdef OPT_CHAFA
-    SwsContext* m_pSwsCtx {};
-    AVFrame* m_pConverted {};
+    CoverLoader* m_pCoverLoader {}; /* Set by the app, not swapped. */
 #endif
 
-
     AVPacket* m_pTmpPacket {};
     AVFrame* m_pTmpFrame {};
     AVFrame* m_pCvtFrame {};
+    isize m_cvtOffset {}; /* Bytes of m_pCvtFrame already consumed by readRaw(). */
+    int m_swrInFormat = -1; /* What m_pSwr is configured for, -1 until the first conversion. */
+    int m_swrOutFormat = -1;
+    audio::PCM_TYPE m_eOutPcmType = audio::PCM_TYPE::F32;
+    bool m_bNoCover = false; /* Audio only (loudness scan), open() skips the attached picture. */
 
     /* */
 
-    void getAttachedPicture();
+    void requestCover(); /* Hands the attached picture to m_pCoverLoader. */
+    [[nodiscard]] audio::ERROR receiveFrame(); /* Next decoded frame into m_pTmpFrame. */
+    [[nodiscard]] bool configureSwr(AVSampleFormat eOut); /* For m_pTmpFrame, only when the formats change. */
+    [[nodiscard]] bool convertFrame(); /* m_pTmpFrame to interleaved m_eOutPcmType m_pCvtFrame, referenced if it already is. */
+    [[nodiscard]] isize convertFrameInto(void* pDst, isize nMaxBytes); /* Bytes written, 0 if it doesn't fit whole or needs m_pCvtFrame. */
+    [[nodiscard]] Span<const u8> pendingBytes() const;
+    void trimConverted(); /* Skips the part of m_pCvtFrame before m_skipToFrame. */
+    void swap(Decoder* pOther) noexcept; /* Swaps opened streams, but not the m_mtx, lock both. */
 };
 
 } /* namespace platform::ffmpeg */
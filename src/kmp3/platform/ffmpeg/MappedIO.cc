@@ -0,0 +1,103 @@
+#include "MappedIO.hh"
+#include "dll.hh"
+
+#include <unistd.h>
+
+namespace platform::ffmpeg
+{
+
+bool
+MappedIO::open(const char* ntsPath)
+{
+    /* Pipes and devices would block or can't be mapped, ffmpeg's own protocols handle them. */
+    if (file::fileType(ntsPath) != file::TYPE::FILE) return false;
+
+    m_mapped = file::map(ntsPath);
+    if (!m_mapped.data()) return false;
+
+    madvise(m_mapped.data(), m_mapped.size(), MADV_SEQUENTIAL);
+
+    u8* pBuff = static_cast<u8*>(dll::av_malloc(BUFFER_SIZE));
+    if (pBuff) m_pAvio = dll::avio_alloc_context(pBuff, BUFFER_SIZE, 0, this, readPacket, {}, seek);
+
+    if (!m_pAvio)
+    {
+        dll::av_free(pBuff);
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void
+MappedIO::close() noexcept
+{
+    if (m_pAvio)
+    {
+        dll::av_freep(&m_pAvio->buffer);
+        dll::avio_context_free(&m_pAvio);
+    }
+
+    if (m_mapped.data()) m_mapped.unmap();
+
+    m_pos = 0;
+    m_adviseStart = m_adviseEnd = -1;
+}
+
+void
+MappedIO::adviseReadAhead() noexcept
+{
+    /* Once per half a window. */
+    if (m_pos >= m_adviseStart && m_pos + READ_AHEAD / 2 <= m_adviseEnd) return;
+
+    static const isize s_pageSize = sysconf(_SC_PAGESIZE);
+
+    const isize start = m_pos - m_pos % s_pageSize;
+    const isize end = utils::min(m_pos + READ_AHEAD, m_mapped.size());
+    if (end > start) madvise(m_mapped.data() + start, end - start, MADV_WILLNEED);
+
+    m_adviseStart = start;
+    m_adviseEnd = end;
+}
+
+int
+MappedIO::readPacket(void* pOpaque, u8* pBuff, int buffSize)
+{
+    auto* s = static_cast<MappedIO*>(pOpaque);
+
+    const isize n = utils::min(isize(buffSize), s->m_mapped.size() - s->m_pos);
+    if (n <= 0) return AVERROR_EOF;
+
+    s->adviseReadAhead();
+    utils::memCopy(pBuff, reinterpret_cast<const u8*>(s->m_mapped.data() + s->m_pos), n);
+    s->m_pos += n;
+
+    return int(n);
+}
+
+int64_t
+MappedIO::seek(void* pOpaque, int64_t offset, int whence)
+{
+    auto* s = static_cast<MappedIO*>(pOpaque);
+    const isize size = s->m_mapped.size();
+
+    i64 pos = 0;
+    switch (whence & ~AVSEEK_FORCE)
+    {
+        case AVSEEK_SIZE: return size;
+
+        case SEEK_SET: pos = offset; break;
+        case SEEK_CUR: pos = s->m_pos + offset; break;
+        case SEEK_END: pos = size + offset; break;
+
+        default: return AVERROR(EINVAL);
+    }
+
+    if (pos < 0 || pos > size) return AVERROR(EINVAL);
+
+    s->m_pos = pos;
+    return pos;
+}
+
+} /* namespace platform::ffmpeg */
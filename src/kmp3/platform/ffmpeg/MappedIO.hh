@@ -0,0 +1,38 @@
+#pragma once
+
+extern "C"
+{
+
+#include <libavformat/avformat.h>
+
+}
+
+namespace platform::ffmpeg
+{
+
+/* AVIOContext over a memory mapped local file, instead of ffmpeg's read() based file protocol.
+ * Whole mapping is MADV_SEQUENTIAL, reads ask for MADV_WILLNEED on the next READ_AHEAD bytes, seeks only move m_pos.
+ * Heap allocated by the Decoder, m_pAvio->opaque points here. */
+struct MappedIO
+{
+    static constexpr isize BUFFER_SIZE = 64 * 1024; /* avio's own buffer. */
+    static constexpr isize READ_AHEAD = 2 * 1024 * 1024;
+
+    file::Mapped m_mapped {};
+    AVIOContext* m_pAvio {};
+    isize m_pos {};
+    isize m_adviseStart = -1; /* Last advised window. */
+    isize m_adviseEnd = -1;
+
+    /* */
+
+    [[nodiscard]] bool open(const char* ntsPath); /* false for anything but a non empty regular file. */
+    void close() noexcept;
+
+protected:
+    void adviseReadAhead() noexcept;
+    static int readPacket(void* pOpaque, u8* pBuff, int buffSize);
+    static int64_t seek(void* pOpaque, int64_t offset, int whence); /* Not i64, long vs long long. */
+};
+
+} /* namespace platform::ffmpeg */
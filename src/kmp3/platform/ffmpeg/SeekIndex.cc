@@ -0,0 +1,227 @@
+#include "SeekIndex.hh"
+#include "dll.hh"
+
+namespace platform::ffmpeg
+{
+
+const SeekIndex::Point*
+SeekIndex::find(i64 frame) const noexcept
+{
+    isize lo = 0, hi = m_vPoints.size();
+    while (lo < hi)
+    {
+        const isize mid = lo + (hi - lo) / 2;
+        if (m_vPoints[mid].frame <= frame) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return lo > 0 ? &m_vPoints[lo - 1] : nullptr;
+}
+
+void
+SeekIndexer::start()
+{
+    new(&m_mtx) Mutex {Mutex::TYPE::PLAIN};
+    new(&m_cnd) CndVar {INIT};
+
+    m_bStarted = true;
+    new(&m_thrd) Thread {
+        [](void* p) { return static_cast<SeekIndexer*>(p)->loop(); },
+        this
+    };
+}
+
+void
+SeekIndexer::destroy() noexcept
+{
+    if (!m_bStarted) return;
+
+    {
+        LockScope lock {&m_mtx};
+        m_atom_bQuit.store(true, atomic::ORDER::RELEASE);
+        m_cnd.signal();
+    }
+    m_thrd.join();
+
+    for (Entry& e : m_aEntries) e.index.m_vPoints.destroy();
+    m_mtx.destroy();
+    m_cnd.destroy();
+    m_bStarted = false;
+}
+
+SeekIndexer::Entry*
+SeekIndexer::search(StringView svPath)
+{
+    for (Entry& e : m_aEntries)
+        if (e.svPath.size() > 0 && e.svPath == svPath) return &e;
+
+    return nullptr;
+}
+
+void
+SeekIndexer::request(StringView svPath, bool bPreload)
+{
+    if (!m_bStarted) return;
+
+    LockScope lock {&m_mtx};
+
+    if (search(svPath) || m_svBuilding == svPath) return;
+
+    if (bPreload)
+    {
+        if (m_svPending == svPath) return;
+        m_svPendingPreload = svPath;
+    }
+    else
+    {
+        if (m_svPendingPreload == svPath) m_svPendingPreload = {};
+        m_svPending = svPath;
+    }
+
+    m_cnd.signal();
+}
+
+bool
+SeekIndexer::findPoint(StringView svPath, i64 frame, SeekIndex::Point* pPoint)
+{
+    if (!m_bStarted) return false;
+
+    LockScope lock {&m_mtx};
+
+    const Entry* pEntry = search(svPath);
+    if (!pEntry) return false;
+
+    const SeekIndex::Point* pFound = pEntry->index.find(frame);
+    if (!pFound) return false;
+
+    *pPoint = *pFound;
+    return true;
+}
+
+bool
+SeekIndexer::findEndFrame(StringView svPath, i64* pEndFrame)
+{
+    if (!m_bStarted) return false;
+
+    LockScope lock {&m_mtx};
+
+    const Entry* pEntry = search(svPath);
+    if (!pEntry) return false;
+
+    *pEndFrame = pEntry->index.m_endFrame;
+    return true;
+}
+
+THREAD_STATUS
+SeekIndexer::loop()
+{
+    while (true)
+    {
+        StringView svPath {};
+        {
+            LockScope lock {&m_mtx};
+            while (!m_atom_bQuit.load(atomic::ORDER::ACQUIRE) && m_svPending.size() == 0 && m_svPendingPreload.size() == 0)
+                m_cnd.wait(&m_mtx);
+
+            if (m_atom_bQuit.load(atomic::ORDER::ACQUIRE)) break;
+
+            StringView* pSvNext = m_svPending.size() > 0 ? &m_svPending : &m_svPendingPreload;
+            svPath = m_svBuilding = *pSvNext;
+            *pSvNext = {};
+        }
+
+        const time::Type t0 = time::nowUS();
+        SeekIndex index {};
+        if (!build(svPath, &index))
+        {
+            index.m_vPoints.destroy();
+            LockScope lock {&m_mtx};
+            m_svBuilding = {};
+            continue;
+        }
+
+        LogDebug{"seek index: '{}', {} points, {} frames, {} ms\n",
+            svPath, index.m_vPoints.size(), index.m_endFrame, (time::nowUS() - t0) / 1000
+        };
+
+        LockScope lock {&m_mtx};
+        m_svBuilding = {};
+        Entry& e = m_aEntries[m_nextEntryI];
+        e.index.m_vPoints.destroy();
+        e = {.svPath = svPath, .index = index};
+        m_nextEntryI = (m_nextEntryI + 1) % MAX_CACHED;
+    }
+
+    return THREAD_STATUS(0);
+}
+
+bool
+SeekIndexer::build(StringView svPath, SeekIndex* pIndex)
+{
+    String sPathNullTerm = String(Gpa::inst(), svPath);
+    defer( sPathNullTerm.destroy(Gpa::inst()) );
+
+    AVFormatContext* pFormatCtx {};
+    if (dll::avformat_open_input(&pFormatCtx, sPathNullTerm.data(), {}, {}) != 0) return false;
+    defer( dll::avformat_close_input(&pFormatCtx) );
+
+    if (dll::avformat_find_stream_info(pFormatCtx, {}) < 0) return false;
+
+    const int idx = dll::av_find_best_stream(pFormatCtx, AVMEDIA_TYPE_AUDIO, -1, -1, {}, 0);
+    if (idx < 0) return false;
+
+    for (int i = 0; i < int(pFormatCtx->nb_streams); ++i)
+        if (i != idx) pFormatCtx->streams[i]->discard = AVDISCARD_ALL;
+
+    const AVStream* pStream = pFormatCtx->streams[idx];
+    const int sampleRate = pStream->codecpar->sample_rate;
+    if (sampleRate <= 0) return false;
+
+    AVPacket* pPacket = dll::av_packet_alloc();
+    defer( dll::av_packet_free(&pPacket) );
+
+    /* Sum durations in the stream time base, rescaling each packet would accumulate rounding. */
+    const AVRational frameTimeBase {1, sampleRate};
+    const i64 interval = SeekIndex::INTERVAL_MS * sampleRate / 1000;
+    i64 ticks = 0;
+    i64 frame = 0;
+    i64 nextPointFrame = 0;
+    isize nPackets = 0;
+
+    while (dll::av_read_frame(pFormatCtx, pPacket) == 0)
+    {
+        defer( dll::av_packet_unref(pPacket) );
+
+        /* Give up on quit or when a song starts playing, it gets requested again on the next open().
+         * Preloads don't interrupt, they queue behind. */
+        if ((++nPackets & 1023) == 0)
+        {
+            if (m_atom_bQuit.load(atomic::ORDER::ACQUIRE)) return false;
+
+            LockScope lock {&m_mtx};
+            if (m_svPending.size() > 0) return false;
+        }
+
+        if (pPacket->stream_index != idx) continue;
+
+        if (pPacket->duration <= 0)
+        {
+            LogDebug{"seek index: packet without duration in '{}'\n", svPath};
+            return false;
+        }
+
+        if (frame >= nextPointFrame && pPacket->pos >= 0)
+        {
+            pIndex->m_vPoints.push({.frame = frame, .pos = pPacket->pos});
+            nextPointFrame = frame + interval;
+        }
+
+        ticks += pPacket->duration;
+        frame = dll::av_rescale_q(ticks, pStream->time_base, frameTimeBase);
+    }
+
+    pIndex->m_endFrame = frame;
+    return pIndex->m_vPoints.size() > 0;
+}
+
+} /* namespace platform::ffmpeg */
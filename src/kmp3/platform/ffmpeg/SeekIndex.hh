@@ -0,0 +1,72 @@
+#pragma once
+
+extern "C"
+{
+
+#include <libavformat/avformat.h>
+
+}
+
+namespace platform::ffmpeg
+{
+
+/* Packet positions of one audio stream, for files where ffmpeg can only estimate the duration from the bitrate
+ * (VBR mp3 without a TOC, adts, other headerless streams). Seeks go to the byte offset of a point and decode
+ * forward from its exact frame, end frame is the exact length. */
+struct SeekIndex
+{
+    static constexpr i64 INTERVAL_MS = 500; /* Between points. */
+
+    struct Point
+    {
+        i64 frame {}; /* Sample frame the packet starts at. */
+        i64 pos {}; /* Byte offset of the packet. */
+    };
+
+    VecManaged<Point> m_vPoints {};
+    i64 m_endFrame {};
+
+    /* */
+
+    [[nodiscard]] const Point* find(i64 frame) const noexcept; /* Last point at or before frame, nullptr if none. */
+};
+
+/* Builds SeekIndexes on its own thread from a separate demuxer, only packets are read, nothing is decoded.
+ * Keeps the last MAX_CACHED by path. The playing song goes first and a newer one supersedes it,
+ * preloaded next song waits for it and never interrupts it. Paths must outlive the indexer. */
+struct SeekIndexer
+{
+    static constexpr isize MAX_CACHED = 16;
+
+    struct Entry
+    {
+        StringView svPath {};
+        SeekIndex index {};
+    };
+
+    Mutex m_mtx {};
+    CndVar m_cnd {};
+    Thread m_thrd {};
+    Entry m_aEntries[MAX_CACHED] {};
+    isize m_nextEntryI {}; /* Oldest one gets replaced. */
+    StringView m_svPending {}; /* Playing song. */
+    StringView m_svPendingPreload {}; /* Next song, after m_svPending. */
+    StringView m_svBuilding {}; /* Thread's current one, requests for it are already served. */
+    atomic::Bool m_atom_bQuit {false};
+    bool m_bStarted = false;
+
+    /* */
+
+    void start();
+    void destroy() noexcept;
+    void request(StringView svPath, bool bPreload); /* Does nothing if it's already indexed or being built. */
+    [[nodiscard]] bool findPoint(StringView svPath, i64 frame, SeekIndex::Point* pPoint);
+    [[nodiscard]] bool findEndFrame(StringView svPath, i64* pEndFrame);
+
+protected:
+    THREAD_STATUS loop();
+    [[nodiscard]] bool build(StringView svPath, SeekIndex* pIndex); /* false if it failed or a playing song got requested. */
+    [[nodiscard]] Entry* search(StringView svPath); /* m_mtx must be locked. */
+};
+
+} /* namespace platform::ffmpeg */
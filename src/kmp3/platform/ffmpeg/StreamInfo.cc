@@ -0,0 +1,167 @@
+#include "StreamInfo.hh"
+
+namespace platform::ffmpeg
+{
+
+void
+StreamInfoCache::start(StringView svCacheDir)
+{
+    new(&m_mtx) Mutex {Mutex::TYPE::PLAIN};
+    new(&m_mInfos) Map<StringView, StreamInfo> {Gpa::inst()};
+
+    if (svCacheDir.size() > 0)
+    {
+        char aPath[1024] {};
+        const isize n = print::toBuffer(aPath, sizeof(aPath) - 1, "{}/streaminfo", svCacheDir);
+        aPath[n] = '\0';
+
+        load({aPath, n});
+        m_pCacheFile = fopen(aPath, "ab");
+        if (!m_pCacheFile) LogWarn{"failed to open '{}': {}\n", aPath, strerror(errno)};
+    }
+
+    m_bStarted = true;
+}
+
+void
+StreamInfoCache::destroy() noexcept
+{
+    if (!m_bStarted) return;
+
+    if (m_pCacheFile) fclose(m_pCacheFile);
+    m_mInfos.destroy(Gpa::inst());
+    m_sCache.destroy(Gpa::inst());
+    m_mtx.destroy();
+    m_pCacheFile = {};
+    m_bStarted = false;
+}
+
+bool
+StreamInfoCache::find(StringView svPath, i64 size, i64 mtime, StreamInfo* pInfo)
+{
+    if (!m_bStarted) return false;
+
+    LockScope lock {&m_mtx};
+
+    auto found = m_mInfos.search(svPath);
+    if (!found || found.value().size != size || found.value().mtime != mtime) return false;
+
+    *pInfo = found.value();
+    return true;
+}
+
+void
+StreamInfoCache::add(StringView svPath, const StreamInfo& info)
+{
+    if (!m_bStarted) return;
+
+    LockScope lock {&m_mtx};
+
+    /* Some files never match their header (adts without a rate), they get probed on every open with the same result. */
+    if (auto found = m_mInfos.search(svPath))
+    {
+        if (found.value() == info) return;
+        found.value() = info;
+    }
+    else
+    {
+        m_mInfos.insert(Gpa::inst(), svPath, info);
+    }
+
+    if (m_pCacheFile)
+    {
+        writeLine(m_pCacheFile, svPath, info);
+        fflush(m_pCacheFile);
+    }
+}
+
+void
+StreamInfoCache::writeLine(FILE* pFile, StringView svPath, const StreamInfo& info)
+{
+    char aLine[4096 + 256];
+    const isize n = print::toBuffer(aLine, sizeof(aLine), "{} {} {} {} {} {} {} {} {}\n",
+        info.size, info.mtime, info.streamIdx, info.codecId, info.sampleRate, info.nChannels,
+        info.duration, info.eDurationMethod, svPath
+    );
+    fwrite(aLine, 1, n, pFile);
+}
+
+void
+StreamInfoCache::rewrite(const char* ntsCachePath)
+{
+    /* Next to it and renamed over, a crash leaves the old file. */
+    char aTmpPath[1024 + 8] {};
+    const isize n = print::toBuffer(aTmpPath, sizeof(aTmpPath) - 1, "{}.tmp", ntsCachePath);
+    aTmpPath[n] = '\0';
+
+    FILE* pFile = fopen(aTmpPath, "wb");
+    if (!pFile)
+    {
+        LogWarn{"failed to open '{}': {}\n", aTmpPath, strerror(errno)};
+        return;
+    }
+
+    for (auto& kv : m_mInfos) writeLine(pFile, kv.key, kv.val);
+
+    if (fclose(pFile) != 0 || rename(aTmpPath, ntsCachePath) != 0)
+    {
+        LogWarn{"failed to rewrite '{}': {}\n", ntsCachePath, strerror(errno)};
+        remove(aTmpPath);
+    }
+}
+
+void
+StreamInfoCache::load(StringView svCachePath)
+{
+    m_sCache = file::load(Gpa::inst(), svCachePath.data());
+    if (m_sCache.size() <= 0) return;
+
+    /* size mtime streamIdx codecId sampleRate nChannels duration eDurationMethod path */
+    constexpr isize N_FIELDS = 8;
+    isize nOutdated = 0;
+    for (StringView svLine : StringWordIt {m_sCache, "\n"})
+    {
+        StreamInfo info {};
+        StringView svRest = svLine;
+        isize fieldI = 0;
+
+        for (; fieldI < N_FIELDS; ++fieldI)
+        {
+            const isize spaceI = svRest.charAt(' ');
+            if (spaceI == NPOS) break;
+
+            const StringView svField = svRest.subString(0, spaceI);
+            switch (fieldI)
+            {
+                case 0: info.size = svField.toI64(); break;
+                case 1: info.mtime = svField.toI64(); break;
+                case 2: info.streamIdx = int(svField.toI64()); break;
+                case 3: info.codecId = int(svField.toI64()); break;
+                case 4: info.sampleRate = int(svField.toI64()); break;
+                case 5: info.nChannels = int(svField.toI64()); break;
+                case 6: info.duration = svField.toI64(); break;
+                case 7: info.eDurationMethod = int(svField.toI64()); break;
+            }
+
+            svRest = svRest.subString(spaceI + 1);
+        }
+
+        if (fieldI != N_FIELDS || svRest.size() <= 0) continue;
+
+        if (auto found = m_mInfos.search(svRest))
+        {
+            found.value() = info;
+            ++nOutdated;
+        }
+        else
+        {
+            m_mInfos.insert(Gpa::inst(), svRest, info);
+        }
+    }
+
+    LogDebug{"stream info: {} cached entries, {} outdated lines\n", m_mInfos.m_nOccupied, nOutdated};
+
+    if (nOutdated > 0) rewrite(svCachePath.data());
+}
+
+} /* namespace platform::ffmpeg */
@@ -0,0 +1,46 @@
+#pragma once
+
+namespace platform::ffmpeg
+{
+
+/* What avformat_find_stream_info() found for a file, enough to open it again without probing. */
+struct StreamInfo
+{
+    i64 size {}; /* File size and mtime invalidate the entry. */
+    i64 mtime {};
+    int streamIdx {};
+    int codecId {};
+    int sampleRate {};
+    int nChannels {};
+    i64 duration {}; /* AV_TIME_BASE units. */
+    int eDurationMethod {}; /* AVDurationEstimationMethod. */
+
+    /* */
+
+    bool operator==(const StreamInfo&) const = default;
+};
+
+/* StreamInfos of probed files, appended to the 'streaminfo' file in the cache directory, the last entry for a path wins.
+ * Only changes get appended, load() rewrites the file without the outdated lines. Shared by every Decoder that has it set (player and loudness scan). Paths must outlive the cache. */
+struct StreamInfoCache
+{
+    Mutex m_mtx {};
+    Map<StringView, StreamInfo> m_mInfos {}; /* Keys point into m_sCache or the playlist. */
+    String m_sCache {};
+    FILE* m_pCacheFile {};
+    bool m_bStarted = false;
+
+    /* */
+
+    void start(StringView svCacheDir); /* Empty svCacheDir keeps it in memory only. */
+    void destroy() noexcept;
+    [[nodiscard]] bool find(StringView svPath, i64 size, i64 mtime, StreamInfo* pInfo);
+    void add(StringView svPath, const StreamInfo& info); /* Does nothing if it's already there with the same values. */
+
+protected:
+    void load(StringView svCachePath);
+    void rewrite(const char* ntsCachePath); /* One line per path, from m_mInfos. */
+    void writeLine(FILE* pFile, StringView svPath, const StreamInfo& info);
+};
+
+} /* namespace platform::ffmpeg */
@@ -46,8 +46,10 @@ void unloadLibs();
 \
     swr_alloc_set_opts2,\
     swr_config_frame,\
+    swr_init,\
     swr_free,\
     swr_convert_frame,\
+    swr_convert,\
 \
     av_image_fill_linesizes,\
     av_frame_get_buffer,\
@@ -62,9 +64,20 @@ void unloadLibs();
     av_rescale_q,\
     av_seek_frame,\
     av_packet_unref,\
+    av_packet_ref,\
 \
     av_frame_unref,\
-    av_strerror
+    av_frame_ref,\
+    av_frame_clone,\
+    av_new_packet,\
+    av_strerror,\
+\
+    avformat_alloc_context,\
+    avio_alloc_context,\
+    avio_context_free,\
+    av_malloc,\
+    av_free,\
+    av_freep
 
 ADT_PP_FOR_EACH(PLATFORM_FFMPEG_DLL_PFN_EXTERN, PLATFORM_FFMPEG_DLL_CORE_PFN_LIST)
 
@@ -67,14 +67,28 @@ formatByteSize(spa_audio_format eFormat)
     };
 }
 
+static spa_audio_format
+spaFormat(audio::PCM_TYPE e)
+{
+    switch (e)
+    {
+        case audio::PCM_TYPE::S16: return SPA_AUDIO_FORMAT_S16;
+        case audio::PCM_TYPE::S32: return SPA_AUDIO_FORMAT_S32;
+        case audio::PCM_TYPE::F32: return SPA_AUDIO_FORMAT_F32;
+    }
+
+    return SPA_AUDIO_FORMAT_F32;
+}
+
 Mixer&
 Mixer::init()
 {
     m_bRunning = true;
 
-    m_sampleRate = 48000;
-    m_nChannels = 2;
-    m_eformat = SPA_AUDIO_FORMAT_F32;
+    m_nDeviceChannels = m_nChannels = 2;
+    m_eformat = spaFormat(m_eDevicePcmType);
+    m_atom_stride.store(formatByteSize(m_eformat) * m_nDeviceChannels, atomic::ORDER::RELEASE);
+    m_atom_nChannels.store(m_nDeviceChannels, atomic::ORDER::RELEASE);
 
     pw_init({}, {});
 
@@ -101,8 +115,8 @@ Mixer::init()
     spa_audio_info_raw rawInfo {
         .format = m_eformat,
         .flags {},
-        .rate = m_sampleRate,
-        .channels = m_nChannels,
+        .rate = m_deviceSampleRate,
+        .channels = m_nDeviceChannels,
         .position {}
     };
 
@@ -113,7 +127,7 @@ Mixer::init()
         PW_DIRECTION_OUTPUT,
         PW_ID_ANY,
         static_cast<pw_stream_flags>(
-            PW_STREAM_FLAG_AUTOCONNECT | PW_STREAM_FLAG_INACTIVE | PW_STREAM_FLAG_MAP_BUFFERS
+            PW_STREAM_FLAG_AUTOCONNECT | PW_STREAM_FLAG_INACTIVE | PW_STREAM_FLAG_MAP_BUFFERS | PW_STREAM_FLAG_RT_PROCESS
         ),
         aParams,
         utils::size(aParams)
@@ -144,17 +158,12 @@ Mixer::deinit()
 bool
 Mixer::play(StringView svPath)
 {
-    const f64 prevSpeed = f64(m_changedSampleRate) / f64(m_sampleRate);
-
     pause(true);
 
     if (!playFinal(svPath)) return false;
 
-    setNChannels(app::decoder().getChannelsCount());
-    changeSampleRate(app::decoder().getSampleRate(), true);
-
-    if (!utils::floatEq(prevSpeed, 1.0))
-        changeSampleRate(f64(m_sampleRate) * prevSpeed, false);
+    /* Rate is handled by the resampler, only bit-perfect songs change it and the format. */
+    if (needsDeviceConfig()) configureDevice();
 
     pause(false);
 
@@ -162,16 +171,14 @@ Mixer::play(StringView svPath)
 }
 
 void
-Mixer::setNChannels(u32 nChannels)
+Mixer::configureDevice()
 {
-    m_nChannels = nChannels;
-
     u8 aSetupBuff[512] {};
     spa_audio_info_raw rawInfo {
-        .format = m_eformat,
+        .format = spaFormat(m_ePcmType),
         .flags {},
-        .rate = m_sampleRate,
-        .channels = nChannels,
+        .rate = m_deviceSampleRate,
+        .channels = m_nChannels,
         .position {}
     };
 
@@ -182,6 +189,15 @@ Mixer::setNChannels(u32 nChannels)
     pParams = spa_format_audio_raw_build(&b, SPA_PARAM_EnumFormat, &rawInfo);
 
     PWLockScope lock(m_pThrdLoop);
+
+    /* Stream is inactive here (play() pauses first), so onProcess() doesn't see a half updated layout. */
+    m_nDeviceChannels = m_nChannels;
+    m_deviceConfiguredRate = m_deviceSampleRate;
+    m_eDevicePcmType = m_ePcmType;
+    m_eformat = rawInfo.format;
+    m_atom_stride.store(formatByteSize(m_eformat) * m_nDeviceChannels, atomic::ORDER::RELEASE);
+    m_atom_nChannels.store(m_nDeviceChannels, atomic::ORDER::RELEASE);
+
     pw_stream_update_params(m_pStream, &pParams, 1);
 
     /* won't apply without this */
@@ -195,34 +211,20 @@ Mixer::setNChannels(u32 nChannels)
 void
 Mixer::onProcess()
 {
+    /* RT data thread: RingBuffer::pop() is lock-free, its wake up of the refill thread is a signal without the mutex. */
     pw_buffer* pPwBuffer = pw_stream_dequeue_buffer(m_pStream);
-    if (!pPwBuffer)
-    {
-        LogError{"out of buffers: %m"};
-        return;
-    }
+    if (!pPwBuffer) return; /* Out of buffers, graph will call again. */
 
     auto pBuffData = pPwBuffer->buffer->datas[0];
-    f32* pDest = (f32*)pBuffData.data;
-
-    if (!pDest)
-    {
-        LogDebug("pDest == nullptr\n");
-        return;
-    }
+    u8* pDest = (u8*)pBuffData.data;
+    const u32 stride = m_atom_stride.load(atomic::ORDER::ACQUIRE);
+    const u32 nChannels = m_atom_nChannels.load(atomic::ORDER::ACQUIRE);
 
-    u32 stride = formatByteSize(m_eformat) * m_nChannels;
-    u32 nFramesRequested = (stride > 0) ? (pBuffData.maxsize / stride) : 0;
+    /* Follow the graph quantum (requested), whatever it is, only the mapped buffer size limits it. */
+    u32 nFramesRequested = (pDest && stride > 0) ? (pBuffData.maxsize / stride) : 0;
     if (pPwBuffer->requested) nFramesRequested = utils::min((u64)pPwBuffer->requested, (u64)nFramesRequested);
 
-    if (nFramesRequested*m_nChannels > utils::size(audio::g_aDrainBuffer)) nFramesRequested = utils::size(audio::g_aDrainBuffer);
-
-    const f32 vol = m_bMuted ? 0.0f : std::pow(m_volume * (1.0f/100.0f), 3.0f);
-    const isize nSamplesRequested = nFramesRequested * m_nChannels;
-    m_ringBuff.pop({pDest, nSamplesRequested});
-
-    for (isize sampleI = 0; sampleI < nSamplesRequested; ++sampleI)
-        pDest[sampleI] *= vol;
+    if (nFramesRequested > 0) m_ringBuff.popRaw(pDest, isize(nFramesRequested) * nChannels);
 
     pBuffData.chunk->offset = 0;
     pBuffData.chunk->stride = stride;
@@ -243,39 +245,4 @@ Mixer::pause(bool bPause)
     mpris::playbackStatusChanged();
 }
 
-void
-Mixer::changeSampleRate(u64 sampleRate, bool bSave)
-{
-    sampleRate = utils::clamp(sampleRate, app::g_config.minSampleRate, app::g_config.maxSampleRate);
-
-    u8 aSetupBuff[512] {};
-    spa_audio_info_raw rawInfo {
-        .format = m_eformat,
-        .flags {},
-        .rate = static_cast<u32>(sampleRate),
-        .channels = m_nChannels,
-        .position {}
-    };
-
-    spa_pod_builder b {};
-    spa_pod_builder_init(&b, aSetupBuff, sizeof(aSetupBuff));
-
-    const spa_pod* aParams[1] {};
-    aParams[0] = spa_format_audio_raw_build(&b, SPA_PARAM_EnumFormat, &rawInfo);
-
-    PWLockScope lock(m_pThrdLoop);
-    pw_stream_update_params(m_pStream, aParams, utils::size(aParams));
-
-    /* update won't apply without this */
-    {
-        bool bPaused = m_atom_bPaused.load(atomic::ORDER::ACQUIRE);
-        pw_stream_set_active(m_pStream, bPaused);
-        pw_stream_set_active(m_pStream, !bPaused);
-    }
-
-    if (bSave) m_sampleRate = sampleRate;
-
-    m_changedSampleRate = sampleRate;
-}
-
 } /* namespace platform::pipewire */
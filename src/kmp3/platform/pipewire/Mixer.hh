@@ -35,18 +35,22 @@ struct Mixer : public audio::IMixer
     pw_thread_loop* m_pThrdLoop {};
     pw_stream* m_pStream {};
 
+    /* onProcess() runs on the RT data thread without the loop lock, configureDevice() publishes the layout through these. */
+    atomic::Int m_atom_stride {}; /* Bytes per frame. */
+    atomic::Int m_atom_nChannels {};
+
     /* */
 
     virtual Mixer& init() override final;
     virtual void deinit() override final;
     virtual bool play(StringView sPath) override final;
     virtual void pause(bool bPause) override final;
-    virtual void changeSampleRate(u64 sampleRate, bool bSave) override final;
+    [[nodiscard]] virtual bool supportsPcmType(audio::PCM_TYPE) const override final { return true; }
 
     /* */
 
-    void setNChannels(u32 nChannels);
-    void onProcess();
+    void configureDevice(); /* To the current song's channels, rate and format. */
+    void onProcess(); /* No locks, allocations or logging. */
 };
 
 } /* namespace platform::pipewire */
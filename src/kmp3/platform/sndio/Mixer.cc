@@ -9,21 +9,14 @@ namespace platform::sndio
 static constexpr isize N_BUF_FRAMES = 1024;
 
 void
-Mixer::setConfig(u64 sampleRate, int nChannels, bool bSaveNewConfig)
+Mixer::setNChannels(int nChannels)
 {
     LockScope lock {&m_mtxLoop};
 
-    if (bSaveNewConfig)
-    {
-        m_changedSampleRate = m_sampleRate = sampleRate;
-        m_nChannels = nChannels;
-    }
+    m_nDeviceChannels = nChannels;
 
-    sampleRate = utils::clamp(sampleRate, app::g_config.minSampleRate, app::g_config.maxSampleRate);
-    nChannels = utils::clamp(nChannels, 1, 20);
-
-    m_par.pchan = nChannels;
-    m_par.rate = sampleRate;
+    m_par.pchan = utils::clamp(nChannels, 1, 20);
+    m_par.rate = m_deviceSampleRate;
 
     sio_setpar(m_pHdl, &m_par);
 }
@@ -41,15 +34,13 @@ Mixer::loop()
 
     while (m_atom_bRunning.load(atomic::ORDER::ACQUIRE))
     {
-        const f32 vol = m_bMuted ? 0.0f : std::pow(m_volume * (1.0f/100.0f), 3.0f);
-
         const long nSamplesRequested = N_BUF_FRAMES * m_nChannels;
         m_ringBuff.pop({audio::g_aDrainBuffer, nSamplesRequested});
 
         for (isize i = 0; i < nSamplesRequested; ++i)
         {
             const f32 sample = utils::clamp(
-                std::numeric_limits<i16>::max() * (audio::g_aDrainBuffer[i] * vol),
+                std::numeric_limits<i16>::max() * audio::g_aDrainBuffer[i],
                 (f32)std::numeric_limits<i16>::min(),
                 (f32)std::numeric_limits<i16>::max()
             );
@@ -84,7 +75,7 @@ Mixer::init()
     m_bRunning = true;
     m_bMuted = false;
 
-    constexpr u32 sampleRate = 48000;
+    const u32 sampleRate = m_deviceSampleRate;
     constexpr u32 nChannels = 2;
     constexpr u32 bitsPerSample = 16;
     constexpr u32 bytesPerSample = bitsPerSample / 8;
@@ -146,15 +137,11 @@ Mixer::deinit()
 bool
 Mixer::play(StringView svPath)
 {
-    const f64 prevSpeed = f64(m_changedSampleRate) / f64(m_sampleRate);
-
     pause(true);
     if (!playFinal(svPath)) return false;
 
-    setConfig(app::decoder().getSampleRate(), app::decoder().getChannelsCount(), true);
-
-    if (!utils::floatEq(prevSpeed, 1.0))
-        changeSampleRate(f64(m_sampleRate) * prevSpeed, false);
+    /* Rate is handled by the resampler, only a different channel count needs new params. */
+    if (m_nChannels != m_nDeviceChannels) setNChannels(m_nChannels);
 
     pause(false);
 
@@ -184,15 +171,4 @@ Mixer::pause(bool bPause)
     mpris::playbackStatusChanged();
 }
 
-void
-Mixer::changeSampleRate(u64 sampleRate, bool bSave)
-{
-    pause(true);
-    setConfig(sampleRate, m_nChannels, false);
-    pause(false);
-
-    if (bSave) m_sampleRate = sampleRate;
-    m_changedSampleRate = sampleRate;
-}
-
 } /* namespace platform::sndio */
@@ -24,11 +24,10 @@ struct Mixer : public audio::IMixer
     virtual void deinit() override;
     virtual bool play(StringView svPath) override;
     virtual void pause(bool bPause) override;
-    virtual void changeSampleRate(u64 sampleRate, bool bSave) override;
 
     /* */
 
-    void setConfig(u64 sampleRate, int nChannels, bool bSaveNewConfig);
+    void setNChannels(int nChannels);
 
     THREAD_STATUS loop();
 